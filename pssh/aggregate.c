@@ -0,0 +1,283 @@
+/* Groups identical outputs of a fan-out (dshbak style).
+ *
+ * Every member's output is appended to a Capture as it is read from its
+ * pipe.  The capture keeps a running FNV-1a hash, so nothing has to be
+ * re-read to classify it, and holds the bytes in memory only up to
+ * CAPTURE_MEM_LIMIT; anything larger goes to an unlinked temp file.
+ *
+ * Once a member's output is complete it is looked up by hash and length
+ * among the distinct outputs seen so far and compared byte for byte with
+ * the one that matches, then either joins that group (and is thrown
+ * away) or starts a new one.  Memory is therefore bounded by the members
+ * in flight plus one capture per distinct output. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "aggregate.h"
+
+#define INITIAL_BUCKETS 64
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+/* an unlinked, close-on-exec temp file */
+int capture_tmpfile(void)
+{
+    char tmpl[] = "/tmp/pssh-XXXXXX";
+    int fd;
+
+    if ((fd = mkstemp(tmpl)) != -1)
+    {
+        unlink(tmpl);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return fd;
+}
+
+void capture_init(Capture *c)
+{
+    c->hash = FNV_OFFSET;
+    c->len = 0;
+    c->buf = NULL;
+    c->cap = 0;
+    c->spill = -1;
+}
+
+static void spill(Capture *c)
+{
+    if ((c->spill = capture_tmpfile()) == -1)
+        return;
+
+    if (c->len && write(c->spill, c->buf, c->len) != (ssize_t)c->len)
+    {
+        close(c->spill);
+        c->spill = -1;
+        return;
+    }
+
+    free(c->buf);
+    c->buf = NULL;
+    c->cap = 0;
+}
+
+void capture_append(Capture *c, const char *data, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        c->hash ^= (unsigned char)data[i];
+        c->hash *= FNV_PRIME;
+    }
+
+    if (c->spill == -1 && c->len + n > CAPTURE_MEM_LIMIT)
+        spill(c);
+
+    if (c->spill != -1)
+    {
+        write(c->spill, data, n);
+    }
+    else
+    {
+        /* no temp file to be had: keep it in memory after all */
+        if (c->len + n > c->cap)
+        {
+            c->cap = c->cap ? c->cap : 4096;
+            while (c->cap < c->len + n)
+                c->cap *= 2;
+            c->buf = realloc(c->buf, c->cap);
+        }
+        memcpy(c->buf + c->len, data, n);
+    }
+
+    c->len += n;
+}
+
+void capture_free(Capture *c)
+{
+    free(c->buf);
+    if (c->spill != -1)
+        close(c->spill);
+    capture_init(c);
+}
+
+/* copies up to n bytes at off out of c; returns the number copied */
+static size_t capture_read(Capture *c, size_t off, char *dst, size_t n)
+{
+    ssize_t r;
+
+    if (off >= c->len)
+        return 0;
+    if (n > c->len - off)
+        n = c->len - off;
+
+    if (c->spill == -1)
+    {
+        memcpy(dst, c->buf + off, n);
+        return n;
+    }
+
+    r = pread(c->spill, dst, n, off);
+    return r > 0 ? r : 0;
+}
+
+static int capture_equal(Capture *a, Capture *b)
+{
+    char x[8192], y[8192];
+    size_t off = 0, n;
+
+    if (a->hash != b->hash || a->len != b->len)
+        return 0;
+
+    if (a->spill == -1 && b->spill == -1)
+        return !memcmp(a->buf, b->buf, a->len);
+
+    while (off < a->len)
+    {
+        n = capture_read(a, off, x, sizeof(x));
+        if (!n || capture_read(b, off, y, n) != n || memcmp(x, y, n))
+            return 0;
+        off += n;
+    }
+
+    return 1;
+}
+
+static void grow_buckets(Aggregate *A)
+{
+    unsigned int i, h;
+
+    free(A->buckets);
+    A->nbuckets = A->nbuckets ? A->nbuckets * 2 : INITIAL_BUCKETS;
+    A->buckets = malloc(A->nbuckets * sizeof(*A->buckets));
+    memset(A->buckets, -1, A->nbuckets * sizeof(*A->buckets));
+
+    for (i = 0; i < A->ngroups; i++)
+    {
+        h = A->groups[i].out.hash & (A->nbuckets - 1);
+        A->groups[i].next = A->buckets[h];
+        A->buckets[h] = i;
+    }
+}
+
+static void add_member(OutGroup *g, unsigned int member)
+{
+    if (g->nmembers == g->cap)
+    {
+        g->cap = g->cap ? g->cap * 2 : 4;
+        g->members = realloc(g->members, g->cap * sizeof(*g->members));
+    }
+    g->members[g->nmembers++] = member;
+}
+
+/* files member's finished output c (which the aggregate takes over) and
+ * returns the index of the group it landed in */
+int aggregate_add(Aggregate *A, Capture *c, unsigned int member)
+{
+    OutGroup *g;
+    unsigned int h;
+    int i;
+
+    if (A->nbuckets)
+    {
+        h = c->hash & (A->nbuckets - 1);
+        for (i = A->buckets[h]; i != -1; i = A->groups[i].next)
+        {
+            if (capture_equal(&A->groups[i].out, c))
+            {
+                capture_free(c);
+                add_member(&A->groups[i], member);
+                return i;
+            }
+        }
+    }
+
+    if (A->ngroups == A->cap)
+    {
+        A->cap = A->cap ? A->cap * 2 : 16;
+        A->groups = realloc(A->groups, A->cap * sizeof(*A->groups));
+    }
+
+    g = &A->groups[A->ngroups++];
+    g->out = *c;
+    g->members = NULL;
+    g->nmembers = g->cap = 0;
+    add_member(g, member);
+    capture_init(c);
+
+    if (A->ngroups > A->nbuckets - A->nbuckets / 4)
+        grow_buckets(A);
+    else
+    {
+        h = g->out.hash & (A->nbuckets - 1);
+        g->next = A->buckets[h];
+        A->buckets[h] = A->ngroups - 1;
+    }
+
+    return A->ngroups - 1;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void print_group(OutGroup *g, int id, char **labels, FILE *fp)
+{
+    char buf[8192], last = '\n';
+    size_t off = 0, n;
+    unsigned int i;
+
+    fprintf(fp, "----------------\ngroup %d: ", id);
+    for (i = 0; i < g->nmembers; i++)
+        fprintf(fp, "%s%s", i ? "," : "", labels[g->members[i]]);
+    fprintf(fp, "\n----------------\n");
+
+    while ((n = capture_read(&g->out, off, buf, sizeof(buf))))
+    {
+        fwrite(buf, 1, n, fp);
+        last = buf[n - 1];
+        off += n;
+    }
+    if (last != '\n')
+        fputc('\n', fp);
+}
+
+/* prints every distinct output once, under the labels of the members
+ * that produced it.  Groups keep the numbers aggregate_add() gave them. */
+void aggregate_print(Aggregate *A, char **labels, int fd)
+{
+    unsigned int i;
+    FILE *fp;
+
+    if (!(fp = fdopen(dup(fd), "w")))
+        return;
+
+    for (i = 0; i < A->ngroups; i++)
+    {
+        qsort(A->groups[i].members, A->groups[i].nmembers,
+              sizeof(unsigned int), cmp_uint);
+        print_group(&A->groups[i], i, labels, fp);
+    }
+
+    fclose(fp);
+}
+
+void aggregate_free(Aggregate *A)
+{
+    unsigned int i;
+
+    for (i = 0; i < A->ngroups; i++)
+    {
+        capture_free(&A->groups[i].out);
+        free(A->groups[i].members);
+    }
+    free(A->groups);
+    free(A->buckets);
+    memset(A, 0, sizeof(*A));
+}
@@ -0,0 +1,47 @@
+#ifndef _aggregate_h_
+#define _aggregate_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* output kept in memory per capture before it is spilled to a file */
+#define CAPTURE_MEM_LIMIT 65536
+
+typedef struct
+{
+    uint64_t hash;      /* FNV-1a of everything appended so far */
+    size_t len;
+    char *buf;          /* the output while it fits in memory */
+    size_t cap;
+    int spill;          /* temp file holding the output, or -1 */
+} Capture;
+
+typedef struct
+{
+    Capture out;        /* the output every member produced */
+    unsigned int *members;
+    unsigned int nmembers;
+    unsigned int cap;
+    int next;           /* next group in the same bucket, -1 at the end */
+} OutGroup;
+
+/* distinct outputs, indexed by their hash */
+typedef struct
+{
+    OutGroup *groups;
+    unsigned int ngroups;
+    unsigned int cap;
+    int *buckets;       /* first group per bucket, -1 if empty */
+    unsigned int nbuckets;
+} Aggregate;
+
+int capture_tmpfile(void);
+void capture_init(Capture *c);
+void capture_append(Capture *c, const char *data, size_t n);
+void capture_free(Capture *c);
+
+int aggregate_add(Aggregate *A, Capture *c, unsigned int member);
+void aggregate_print(Aggregate *A, char **labels, int fd);
+void aggregate_free(Aggregate *A);
+
+#endif /* _aggregate_h_ */
@@ -0,0 +1,103 @@
+/* Bump allocator for data that lives exactly as long as one command line.
+ *
+ * Blocks are kept across resets, so once the arena has grown to fit a
+ * typical line, parsing it makes no calls to malloc() at all. */
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK 16384
+#define ARENA_ALIGN 16
+
+static ArenaBlock *new_block(size_t size)
+{
+    ArenaBlock *b = malloc(sizeof(*b) + size);
+
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+
+    return b;
+}
+
+void *arena_alloc(Arena *A, size_t size)
+{
+    ArenaBlock *b;
+    size_t want;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (!A->cur)
+        A->first = A->cur = new_block(size > ARENA_BLOCK ? size : ARENA_BLOCK);
+
+    if (A->cur->used + size > A->cur->size)
+    {
+        /* move on to a block left over from before the last reset, or
+         * insert a new one twice the size of the current block */
+        b = A->cur->next;
+        if (b && b->size >= size)
+        {
+            b->used = 0;
+        }
+        else
+        {
+            want = A->cur->size * 2;
+            b = new_block(want > size ? want : size);
+            b->next = A->cur->next;
+            A->cur->next = b;
+        }
+        A->cur = b;
+    }
+
+    p = A->cur->data + A->cur->used;
+    A->cur->used += size;
+
+    return p;
+}
+
+void *arena_calloc(Arena *A, size_t n, size_t size)
+{
+    void *p = arena_alloc(A, n * size);
+
+    memset(p, 0, n * size);
+    return p;
+}
+
+char *arena_strndup(Arena *A, const char *s, size_t n)
+{
+    char *d;
+
+    n = strnlen(s, n);
+    d = arena_alloc(A, n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+
+    return d;
+}
+
+char *arena_strdup(Arena *A, const char *s)
+{
+    return arena_strndup(A, s, strlen(s));
+}
+
+/* O(1): later blocks are reused (and rewound) as allocation reaches them */
+void arena_reset(Arena *A)
+{
+    A->cur = A->first;
+    if (A->cur)
+        A->cur->used = 0;
+}
+
+void arena_free(Arena *A)
+{
+    ArenaBlock *b, *next;
+
+    for (b = A->first; b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+    A->first = A->cur = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+#include <stddef.h>
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size;        /* usable bytes in data[] */
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+/* A bump allocator: allocations are carved out of large blocks and are
+ * never freed one by one; arena_reset() releases all of them at once */
+typedef struct
+{
+    ArenaBlock *first;
+    ArenaBlock *cur;
+} Arena;
+
+void *arena_alloc(Arena *A, size_t size);
+void *arena_calloc(Arena *A, size_t n, size_t size);
+char *arena_strdup(Arena *A, const char *s);
+char *arena_strndup(Arena *A, const char *s, size_t n);
+void arena_reset(Arena *A);
+void arena_free(Arena *A);
+
+#endif /* _arena_h_ */
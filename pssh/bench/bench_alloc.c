@@ -0,0 +1,65 @@
+/* Counts the heap allocations needed to parse a command line.
+ *
+ * Each line is copied (as readline would hand it back), parsed and
+ * released the way pssh does it, and the number of malloc/calloc/realloc
+ * calls is reported per line once the arena has warmed up.
+ *
+ *   usage: bench_alloc [-n iterations]  */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "arena.h"
+#include "malloc_count.h"
+
+static const char *corpus[] = {
+    "ls",
+    "ls -lh | grep 8.*K | wc -l",
+    "wc -l < somefile.txt > numlines.txt",
+    "echo \"foo bar\" 'baz qux' > foo.txt",
+    "cat a b c d e f g h | sort | uniq -c | sort -rn | head -20 > top.txt &",
+    "gcc -g -Wall -O2 -I. -c parse.c -o parse.o",
+    NULL};
+
+int main(int argc, char **argv)
+{
+    int iterations = 10000;
+    unsigned long calls, frees;
+    Arena A = {0};
+    char *line;
+    Parse *P;
+    int opt, i, c;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt != 'n')
+        {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+        iterations = atoi(optarg);
+    }
+
+    printf("%-12s %-12s %s\n", "mallocs/line", "frees/line", "command line");
+    for (c = 0; corpus[c]; c++)
+    {
+        calls = malloc_calls;
+        frees = free_calls;
+        for (i = 0; i < iterations; i++)
+        {
+            line = strdup(corpus[c]);   /* what readline hands back */
+            P = parse_cmdline(&A, line);
+            (void)P;
+            arena_reset(&A);
+            free(line);
+        }
+        printf("%-12.2f %-12.2f %s\n",
+               (double)(malloc_calls - calls) / iterations,
+               (double)(free_calls - frees) / iterations, corpus[c]);
+    }
+
+    arena_free(&A);
+    return 0;
+}
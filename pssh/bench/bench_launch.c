@@ -0,0 +1,130 @@
+/* Compares the launch backends in launch.c.
+ *
+ * Builds N-stage pipelines of cat (stdin from /dev/null) with each backend
+ * and reports the time taken to start every stage and the time until all
+ * stages have been reaped.  The process first allocates and touches a
+ * ballast heap to stand in for the shell's readline/history state, since
+ * that is what makes fork() expensive.
+ *
+ *   usage: bench_launch [-n iterations] [-m ballast MiB]  */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "launch.h"
+#include "path.h"
+#include "zygote.h"
+#include "env.h"
+
+static const int stages[] = {1, 8, 64};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* returns the time taken to start the pipeline; *total gets the time
+ * until every stage was reaped */
+static double run_pipeline(LaunchMode mode, const char *cat, int n, double *total)
+{
+    char *argv[] = {"cat", NULL};
+    pid_t pids[64];
+    pid_t pgid = 0;
+    int fd[2];
+    int in, t;
+    double start, started;
+
+    start = now_us();
+    in = open("/dev/null", O_RDONLY);
+    for (t = 0; t < n - 1; t++)
+    {
+        pipe(fd);
+        pids[t] = launch_exec(mode, cat, argv, env_vector(), in, fd[1], STDERR_FILENO, fd[0], pgid, 0, NULL);
+        if (!pgid)
+            pgid = pids[0];
+        close(fd[1]);
+        close(in);
+        in = fd[0];
+    }
+    fd[1] = open("/dev/null", O_WRONLY);
+    pids[t] = launch_exec(mode, cat, argv, env_vector(), in, fd[1], STDERR_FILENO, -1, pgid, 0, NULL);
+    close(fd[1]);
+    close(in);
+    started = now_us();
+
+    for (t = 0; t < n; t++)
+        waitpid(pids[t], NULL, 0);
+    *total = now_us() - start;
+
+    return started - start;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 200;
+    size_t ballast = 256;
+    const char *cat;
+    char *heap;
+    double launch, total, sum_launch, sum_total;
+    int opt, i, s;
+    LaunchMode mode;
+
+    /* the zygote backend re-executes this program */
+    if (!strcmp(argv[0], ZYGOTE_ARGV0))
+        return zygote_main(argc, argv);
+
+    while ((opt = getopt(argc, argv, "n:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'm':
+            ballast = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-m ballast MiB]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    env_init();
+    if (!(cat = path_lookup("cat")))
+    {
+        fprintf(stderr, "bench_launch: cat not found in PATH\n");
+        return 1;
+    }
+    cat = strdup(cat);
+
+    heap = malloc(ballast << 20);
+    memset(heap, 1, ballast << 20);
+
+    printf("ballast %zu MiB, %d iterations\n", ballast, iterations);
+    printf("%-6s %6s %14s %14s\n", "mode", "stages", "launch us", "total us");
+    for (s = 0; s < sizeof(stages) / sizeof(stages[0]); s++)
+    {
+        for (mode = LAUNCH_FORK; mode <= LAUNCH_ZYGOTE; mode++)
+        {
+            sum_launch = sum_total = 0;
+            for (i = 0; i < iterations; i++)
+            {
+                launch = run_pipeline(mode, cat, stages[s], &total);
+                sum_launch += launch;
+                sum_total += total;
+            }
+            printf("%-6s %6d %14.1f %14.1f\n", launch_mode_name(mode), stages[s],
+                   sum_launch / iterations, sum_total / iterations);
+        }
+    }
+
+    free(heap);
+    return 0;
+}
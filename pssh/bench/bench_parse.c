@@ -0,0 +1,178 @@
+/* Parser micro-benchmark.
+ *
+ * Replays the realistic command lines in parse_corpus.txt plus a few
+ * generated adversarial ones (very long pipelines, huge argument lists,
+ * heavy quoting) through parse_cmdline() and reports, per group, lines
+ * parsed per second, nanoseconds per token and heap allocations per line.
+ *
+ *   usage: bench_parse [-c corpus file] [-t seconds per group]  */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "parse.h"
+#include "lex.h"
+#include "arena.h"
+#include "malloc_count.h"
+
+typedef struct
+{
+    const char *name;
+    char **lines;
+    int nlines;
+} Group;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_line(Group *G, char *line)
+{
+    G->lines = realloc(G->lines, (G->nlines + 1) * sizeof(*G->lines));
+    G->lines[G->nlines++] = line;
+}
+
+static int load_corpus(Group *G, const char *file)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    if (!(fp = fopen(file, "r")))
+    {
+        perror(file);
+        return -1;
+    }
+
+    while ((n = getline(&line, &cap, fp)) != -1)
+    {
+        if (n && line[n - 1] == '\n')
+            line[n - 1] = '\0';
+        add_line(G, strdup(line));
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/* builds a line by repeating unit n times, separated by sep */
+static char *repeat(const char *head, const char *unit, const char *sep, int n)
+{
+    size_t len = strlen(head) + n * (strlen(unit) + strlen(sep) + 8) + 1;
+    char *line = malloc(len);
+    char *p = line;
+    int i;
+
+    p += sprintf(p, "%s", head);
+    for (i = 0; i < n; i++)
+        p += sprintf(p, "%s%s%d", sep, unit, i);
+
+    return line;
+}
+
+static unsigned long count_tokens(Group *G)
+{
+    unsigned long n = 0;
+    Arena A = {0};
+    TokenList L;
+    int i;
+
+    for (i = 0; i < G->nlines; i++)
+    {
+        if (lex_cmdline(&A, G->lines[i], &L) == 0)
+            n += L.ntoks;
+        arena_reset(&A);
+    }
+
+    arena_free(&A);
+    return n;
+}
+
+static void run_group(Group *G, double seconds)
+{
+    unsigned long rounds = 0, calls, tokens;
+    double start, elapsed;
+    Arena A = {0};
+    Parse *P;
+    int i;
+
+    tokens = count_tokens(G);
+
+    /* one untimed round so the arena has grown to its working size */
+    for (i = 0; i < G->nlines; i++)
+    {
+        P = parse_cmdline(&A, G->lines[i]);
+        arena_reset(&A);
+    }
+
+    calls = malloc_calls;
+    start = now();
+    do
+    {
+        for (i = 0; i < G->nlines; i++)
+        {
+            P = parse_cmdline(&A, G->lines[i]);
+            (void)P;
+            arena_reset(&A);
+        }
+        rounds++;
+    } while ((elapsed = now() - start) < seconds);
+
+    printf("%-12s %8d %14.0f %10.2f %12.2f\n", G->name, G->nlines,
+           rounds * G->nlines / elapsed,
+           elapsed * 1e9 / (rounds * tokens),
+           (double)(malloc_calls - calls) / (rounds * G->nlines));
+
+    arena_free(&A);
+}
+
+int main(int argc, char **argv)
+{
+    const char *corpus = "bench/parse_corpus.txt";
+    double seconds = 1.0;
+    Group realistic = {"realistic"};
+    Group pipeline = {"pipeline"};
+    Group args = {"100k-args"};
+    Group quoting = {"quoting"};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            corpus = optarg;
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c corpus file] [-t seconds per group]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (load_corpus(&realistic, corpus) == -1)
+        return 1;
+
+    add_line(&pipeline, repeat("cat input", "grep -v pattern", " | ", 1000));
+    add_line(&args, repeat("rm -f", "file", " ./build/obj/", 100000));
+    add_line(&quoting, repeat("echo", "'it''s' \"a | b\"'<c>'", " pre\"fix\"", 20000));
+
+    printf("%-12s %8s %14s %10s %12s\n",
+           "group", "lines", "lines/sec", "ns/token", "mallocs/line");
+    run_group(&realistic, seconds);
+    run_group(&pipeline, seconds);
+    run_group(&args, seconds);
+    run_group(&quoting, seconds);
+
+    return 0;
+}
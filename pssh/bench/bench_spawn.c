@@ -0,0 +1,335 @@
+/* End to end spawn/teardown latency of the shell.
+ *
+ * Starts pssh on a pseudo-terminal, so it runs with job control and the
+ * readline prompt exactly as it would for a user, and types commands at
+ * it.  Each sample is the time from writing the Enter key to the shell
+ * being done with the command: the next prompt for a foreground job, the
+ * "done" report for a background one.  Every scenario gets a fresh shell
+ * and a few unmeasured warm-up runs.  The shells keep their history in
+ * /dev/null rather than the user's history file.
+ *
+ * System calls per command are counted without ptrace.  By default they
+ * come from the syscr/syscw counters in /proc/<shell>/io, which take in
+ * the children the shell has reaped but only count read and write type
+ * calls.  With -P the shell is run under 'perf stat -e
+ * raw_syscalls:sys_enter' instead, which counts every call; a second
+ * shell that runs nothing gives the startup and exit cost to subtract.
+ *
+ * Results go to stdout as CSV, one line per scenario.
+ *
+ *   usage: bench_spawn [-s shell] [-n iterations] [-w warmup] [-P]  */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define TIMEOUT_MS 10000
+
+typedef struct
+{
+    const char *name;
+    const char *cmd;
+    int background;     /* wait for the "done" report, not the prompt */
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"true", "true", 0},
+    {"true_bg", "true &", 1},
+    {"builtin", "which true", 0},
+    {"cat_2", "cat < /dev/null | cat", 0},
+    {"cat_8", "cat < /dev/null | cat | cat | cat | cat | cat | cat | cat", 0},
+    {"cat_32", NULL, 0},   /* built in main() */
+    {"cat_8_bg", "cat < /dev/null | cat | cat | cat | cat | cat | cat | cat &", 1},
+    {"redirect", "cat < /etc/passwd > /dev/null", 0},
+    {"redirect_8", "cat < /etc/passwd | cat | cat | cat | cat | cat | cat | cat > /dev/null", 0},
+};
+
+#define NSCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct
+{
+    pid_t pid;          /* the process on the pty: pssh, or perf */
+    int fd;             /* pty master */
+    char buf[65536];    /* output since the last command was sent */
+    size_t len;
+} Shell;
+
+static const char *shell_path = "./pssh";
+static int use_perf;
+static char perf_out[] = "/tmp/bench_spawn-XXXXXX";
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* reads whatever the shell has written, waiting up to timeout_ms.
+ * Returns 0 on timeout or hangup. */
+static int shell_read(Shell *sh, int timeout_ms)
+{
+    struct pollfd pfd = {sh->fd, POLLIN, 0};
+    ssize_t n;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+
+    /* keep the tail if the buffer fills up: only the end is looked at */
+    if (sh->len > sizeof(sh->buf) / 2)
+    {
+        memmove(sh->buf, sh->buf + sh->len - 1024, 1024);
+        sh->len = 1024;
+    }
+
+    if ((n = read(sh->fd, sh->buf + sh->len, sizeof(sh->buf) - sh->len - 1)) <= 0)
+        return 0;
+
+    sh->len += n;
+    sh->buf[sh->len] = '\0';
+    return 1;
+}
+
+static int ends_with(Shell *sh, const char *s)
+{
+    size_t n = strlen(s);
+
+    return sh->len >= n && !memcmp(sh->buf + sh->len - n, s, n);
+}
+
+/* waits for the prompt, after the "done" report if done is set */
+static int wait_prompt(Shell *sh, int done)
+{
+    while (!ends_with(sh, "$ ") || (done && !strstr(sh->buf, "+ done")))
+        if (!shell_read(sh, TIMEOUT_MS))
+            return -1;
+
+    return 0;
+}
+
+static int shell_start(Shell *sh)
+{
+    char *argv[] = {"perf", "stat", "-x,", "-e", "raw_syscalls:sys_enter",
+                    "-o", perf_out, "--", (char *)shell_path, NULL};
+    /* wide enough that readline never wraps the longest command */
+    struct winsize ws = {.ws_row = 24, .ws_col = 1024};
+
+    sh->len = 0;
+    if ((sh->pid = forkpty(&sh->fd, NULL, NULL, &ws)) == -1)
+    {
+        perror("bench_spawn: forkpty");
+        exit(1);
+    }
+
+    if (!sh->pid)
+    {
+        /* the benchmark's commands stay out of the user's history */
+        setenv("PSSH_HISTFILE", "/dev/null", 1);
+        if (use_perf)
+            execvp(argv[0], argv);
+        else
+            execl(shell_path, shell_path, NULL);
+        perror("bench_spawn: exec");
+        _exit(127);
+    }
+
+    return wait_prompt(sh, 0);
+}
+
+/* returns the total number of system calls perf counted, or -1 */
+static long shell_stop(Shell *sh)
+{
+    char line[256];
+    long count = -1;
+    FILE *fp;
+
+    write(sh->fd, "exit\n", 5);
+    while (shell_read(sh, TIMEOUT_MS))
+        ;
+    close(sh->fd);
+    waitpid(sh->pid, NULL, 0);
+
+    if (!use_perf || !(fp = fopen(perf_out, "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), fp))
+        if (line[0] != '#' && line[0] != '\n' && strstr(line, "raw_syscalls"))
+            count = atol(line);
+    fclose(fp);
+
+    return count;
+}
+
+/* read and write type system calls of the shell and its reaped children */
+static long proc_syscalls(pid_t pid)
+{
+    char path[64], line[128];
+    long n, total = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    if (!(fp = fopen(path, "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "syscr: %ld", &n) == 1 || sscanf(line, "syscw: %ld", &n) == 1)
+            total += n;
+    fclose(fp);
+
+    return total;
+}
+
+/* types cmd, waits for it to be echoed and returns the microseconds from
+ * Enter until the shell was done with it, or -1 */
+static double run_once(Shell *sh, const Scenario *sc, const char *cmd)
+{
+    double start;
+
+    sh->len = 0;
+    write(sh->fd, cmd, strlen(cmd));
+    while (!ends_with(sh, cmd))
+        if (!shell_read(sh, TIMEOUT_MS))
+            return -1;
+
+    sh->len = 0;
+    start = now_us();
+    write(sh->fd, "\n", 1);
+    if (wait_prompt(sh, sc->background) == -1)
+        return -1;
+
+    return now_us() - start;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of the n sorted values in v */
+static double percentile(double *v, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+
+    return v[rank ? rank - 1 : 0];
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 500, warmup = 20;
+    char cat_32[32 * 7 + 32];
+    const char *cmd;
+    double *samples, sum;
+    long before, after, baseline = 0;
+    Shell sh;
+    int opt, i, s, fd;
+
+    while ((opt = getopt(argc, argv, "s:n:w:P")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            shell_path = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'P':
+            use_perf = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s shell] [-n iterations] [-w warmup] [-P]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (iterations <= 0 || access(shell_path, X_OK) == -1)
+    {
+        fprintf(stderr, "bench_spawn: cannot run %s\n", shell_path);
+        return 1;
+    }
+
+    strcpy(cat_32, "cat < /dev/null");
+    for (i = 1; i < 32; i++)
+        strcat(cat_32, " | cat");
+
+    if (use_perf)
+    {
+        if ((fd = mkstemp(perf_out)) == -1)
+        {
+            perror("bench_spawn: mkstemp");
+            return 1;
+        }
+        close(fd);
+
+        if (shell_start(&sh) == -1 || (baseline = shell_stop(&sh)) == -1)
+        {
+            fprintf(stderr, "bench_spawn: perf stat failed, is perf installed?\n");
+            unlink(perf_out);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    samples = malloc(iterations * sizeof(*samples));
+
+    printf("scenario,iterations,p50_us,p99_us,mean_us,syscalls_per_cmd,counter\n");
+    for (s = 0; s < NSCENARIOS; s++)
+    {
+        cmd = scenarios[s].cmd ? scenarios[s].cmd : cat_32;
+        fprintf(stderr, "bench_spawn: %s\n", scenarios[s].name);
+
+        if (shell_start(&sh) == -1)
+        {
+            fprintf(stderr, "bench_spawn: %s: no prompt\n", shell_path);
+            return 1;
+        }
+
+        for (i = 0; i < warmup; i++)
+            run_once(&sh, &scenarios[s], cmd);
+
+        before = use_perf ? 0 : proc_syscalls(sh.pid);
+        for (i = 0, sum = 0; i < iterations; i++)
+        {
+            if ((samples[i] = run_once(&sh, &scenarios[s], cmd)) < 0)
+            {
+                fprintf(stderr, "bench_spawn: %s: timed out\n", scenarios[s].name);
+                return 1;
+            }
+            sum += samples[i];
+        }
+        after = use_perf ? 0 : proc_syscalls(sh.pid);
+
+        /* perf only has its count once the shell is gone, and that
+         * includes the warm-up runs */
+        if (use_perf)
+            after = shell_stop(&sh) - baseline;
+        else
+            shell_stop(&sh);
+
+        qsort(samples, iterations, sizeof(*samples), cmp_double);
+        printf("%s,%d,%.1f,%.1f,%.1f,%.1f,%s\n", scenarios[s].name, iterations,
+               percentile(samples, iterations, 50), percentile(samples, iterations, 99),
+               sum / iterations,
+               use_perf ? (double)after / (iterations + warmup)
+                        : (double)(after - before) / iterations,
+               use_perf ? "perf" : "proc_io_rw");
+        fflush(stdout);
+    }
+
+    if (use_perf)
+        unlink(perf_out);
+    free(samples);
+    return 0;
+}
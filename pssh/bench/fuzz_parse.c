@@ -0,0 +1,93 @@
+/* Fuzz harness for parse_cmdline().
+ *
+ * Built with clang -fsanitize=fuzzer this is a libFuzzer target.  With
+ * -DFUZZ_STANDALONE it gets a main() instead, which parses each file named
+ * on the command line (or stdin when there are none) as one input; that
+ * is what AFL drives and what 'make fuzz-replay' runs under ASan/UBSan. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "parse.h"
+#include "arena.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static Arena A;
+    char *line;
+    Parse *P;
+    int i, j;
+
+    line = malloc(size + 1);
+    memcpy(line, data, size);
+    line[size] = '\0';
+
+    /* walk the whole result so bad pointers are dereferenced here */
+    if ((P = parse_cmdline(&A, line)) && !P->invalid_syntax)
+    {
+        for (i = 0; i < P->ntasks; i++)
+        {
+            /* an empty command has to be reported as a syntax error;
+             * only a lone task can be assignments alone */
+            if (P->tasks[i].cmd ? !*P->tasks[i].cmd : P->ntasks > 1 || !P->tasks[i].nassigns)
+                abort();
+            for (j = 0; j < P->tasks[i].nassigns; j++)
+                (void)strlen(P->tasks[i].assigns[j]);
+            for (j = 0; P->tasks[i].argv[j]; j++)
+                (void)strlen(P->tasks[i].argv[j]);
+        }
+        if (P->infile)
+            (void)strlen(P->infile);
+        if (P->outfile)
+            (void)strlen(P->outfile);
+    }
+
+    arena_reset(&A);
+    free(line);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static void run_file(FILE *fp)
+{
+    char *buf = NULL;
+    size_t len = 0, cap = 0, n;
+
+    do
+    {
+        if (len == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            buf = realloc(buf, cap);
+        }
+        n = fread(buf + len, 1, cap - len, fp);
+        len += n;
+    } while (n);
+
+    LLVMFuzzerTestOneInput((uint8_t *)buf, len);
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    int i;
+
+    if (argc == 1)
+        run_file(stdin);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!(fp = fopen(argv[i], "r")))
+        {
+            perror(argv[i]);
+            continue;
+        }
+        run_file(fp);
+        fclose(fp);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,43 @@
+/* Counts heap allocations made by anything linked into a benchmark,
+ * including the C library's own strdup() and friends, by interposing the
+ * allocator entry points and forwarding to glibc's implementations. */
+#include <stddef.h>
+
+#include "malloc_count.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+unsigned long malloc_calls;
+unsigned long free_calls;
+size_t malloc_bytes;
+
+void *malloc(size_t size)
+{
+    malloc_calls++;
+    malloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    malloc_calls++;
+    malloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    malloc_calls++;
+    malloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+        free_calls++;
+    __libc_free(ptr);
+}
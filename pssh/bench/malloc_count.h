@@ -0,0 +1,11 @@
+#ifndef _malloc_count_h_
+#define _malloc_count_h_
+
+#include <stddef.h>
+
+/* calls to malloc/calloc/realloc and bytes requested since startup */
+extern unsigned long malloc_calls;
+extern unsigned long free_calls;
+extern size_t malloc_bytes;
+
+#endif /* _malloc_count_h_ */
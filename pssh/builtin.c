@@ -4,84 +4,90 @@
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <termios.h>
 
 #include "builtin.h"
 #include "parse.h"
+#include "path.h"
+#include "launch.h"
+#include "parallel.h"
+#include "hosts.h"
+#include "cwd.h"
+#include "history.h"
+#include "env.h"
+#include "prio.h"
+#include "monitor.h"
+#include "trace.h"
 
-static char *builtin[] = {
-    "exit",  /* exits the shell */
-    "which", /* displays full path to command */
-    "jobs",  /* lists all jobs */
-    "kill",  /* sends a signal to a process */
-    "fg",    /* brings a job to the foreground */
-    "bg",    /* sends a job to the background */
-    NULL};
+typedef struct
+{
+    char *name;
+    int (*run)(Task T, Parse *P, JobTable *jobs);
+    int flags;              /* BUILTIN_* */
+} Builtin;
 
-int is_builtin(char *cmd)
+static Builtin builtin[] = {
+    {"exit", NULL, BUILTIN_SHELL},                  /* exits the shell (run by pssh.c) */
+    {"which", builtin_which, 0},                    /* displays full path to command */
+    {"jobs", builtin_jobs, 0},                      /* lists all jobs */
+    {"kill", builtin_kill, 0},                      /* sends a signal to a process */
+    {"fg", builtin_fg, BUILTIN_SHELL},              /* brings a job to the foreground */
+    {"bg", builtin_bg, BUILTIN_SHELL},              /* sends a job to the background */
+    {"hash", builtin_hash, 0},                      /* lists or resets the command path cache */
+    {"rehash", builtin_hash, 0},                    /* empties the command path cache */
+    {"launch", builtin_launch, 0},                  /* shows or selects the process launch backend */
+    {"parallel", builtin_parallel, BUILTIN_SHELL | BUILTIN_OWN_IO}, /* runs a command over many inputs, N at a time */
+    {"on", builtin_on, BUILTIN_SHELL | BUILTIN_OWN_IO}, /* runs a command on a group of hosts */
+    {"cd", builtin_cd, BUILTIN_SHELL},              /* changes the working directory */
+    {"pushd", builtin_pushd, BUILTIN_SHELL},        /* saves the working directory and changes it */
+    {"popd", builtin_popd, BUILTIN_SHELL},          /* returns to the last saved directory */
+    {"dirs", builtin_dirs, 0},                      /* lists the saved directories */
+    {"history", builtin_history, 0},                /* lists or searches the command history */
+    {"export", builtin_export, BUILTIN_SHELL},      /* exports variables to commands, or lists them */
+    {"unset", builtin_unset, BUILTIN_SHELL},        /* removes variables */
+    {"pin", builtin_pin, BUILTIN_SHELL},            /* places a job on CPUs or a NUMA node */
+    {"renice", builtin_renice, BUILTIN_SHELL},      /* changes the nice value of a job */
+    {"trace", builtin_trace, BUILTIN_SHELL},        /* records the shell's hot path to a trace file */
+    {NULL, NULL, 0}};
+
+static Builtin *find_builtin(const char *cmd)
 {
     int i;
 
-    for (i = 0; builtin[i]; i++)
+    for (i = 0; builtin[i].name; i++)
     {
-        if (!strcmp(cmd, builtin[i]))
-            return 1;
+        if (!strcmp(cmd, builtin[i].name))
+            return &builtin[i];
     }
 
-    return 0;
+    return NULL;
 }
-char *command_found_builtin(const char *cmd)
-{
-    char *dir;
-    char *tmp;
-    char *PATH;
-    char *state;
-    char probe[PATH_MAX];
 
-    char *ret;
-
-    if (strstr(cmd, "/"))
-    {
-        if (access(cmd, X_OK) == 0)
-        {
-            ret = strdup(cmd);
-            return ret;
-        }
-    }
+/* name of the i-th builtin, NULL past the last one */
+const char *builtin_name(int i)
+{
+    return builtin[i].name;
+}
 
-    PATH = strdup(getenv("PATH"));
-    for (tmp = PATH;; tmp = NULL)
-    {
+int is_builtin(char *cmd)
+{
+    return find_builtin(cmd) != NULL;
+}
 
-        dir = strtok_r(tmp, ":", &state);
-        if (!dir)
-            break;
-        strncpy(probe, dir, PATH_MAX - 1);
-        strncat(probe, "/", PATH_MAX - 1);
-        strncat(probe, cmd, PATH_MAX - 1);
-        if (access(probe, X_OK) == 0)
-        {
-            ret = strdup(probe);
-            break;
-        }
-    }
+/* BUILTIN_* flags of cmd, 0 if it is not a builtin */
+int builtin_flags(char *cmd)
+{
+    Builtin *b = find_builtin(cmd);
 
-    free(PATH);
-    return ret;
+    return b ? b->flags : 0;
 }
-
-int is_valid_jobno(int jobno, int *job_ids)
+int is_valid_jobno(int jobno, JobTable *jobs)
 {
-    if (jobno > -1 && jobno < 100)
-    {
-        if (job_ids[jobno])
-        {
-            return 1;
-        }
-    }
-    return 0;
+    return job_get(jobs, jobno) != NULL;
 }
 
-int builtin_kill(Task T, Job **jobs, int *job_ids)
+int builtin_kill(Task T, Parse *P, JobTable *jobs)
 {
     char *help_str = "Usage: kill [-s <signal>] <pid> | %%<job>\n";
     int sig = 15;
@@ -97,62 +103,133 @@ int builtin_kill(Task T, Job **jobs, int *job_ids)
         if (argc < 4)
         {
             printf("Usage: kill [-s <signal>] <pid> | %%<job>\n");
-            return 0;
+            return 1;
         }
         sig = atoi(T.argv[2]);
         if (sig == 0 && strcmp("0", T.argv[2]))
         {
             printf("pssh: invalid signal number: [%s]", T.argv[2]);
-            return 0;
+            return 1;
         }
         if (sig > 31 || sig < 0)
         {
             printf("pssh: invalid signal number: [%d]", sig);
-            return 0;
+            return 1;
         }
         targ_start = 3;
     }
     int i, pid, jobno;
+    Job *job;
     for (i = targ_start; i < argc; i++)
     {
         if (T.argv[i][0] == '%')
         {
             jobno = atoi(T.argv[i] + 1);
-            if (!is_valid_jobno(jobno, job_ids))
+            if (!is_valid_jobno(jobno, jobs))
             {
                 printf("pssh: invalid job number: [%d]", jobno);
-                return 0;
+                return 1;
             }
-            int j;
-            for (j = 0; j < jobs[jobno]->npids; j++)
+            job = job_get(jobs, jobno);
+            job_signal(job, sig);
+            if(sig == 18 && job->status != DONE)
             {
-                kill(jobs[jobno]->pids[j], sig);
-            }
-            if(sig == 18)
-            {
-                jobs[jobno]->status = BG;
+                job->status = BG;
             }
         }
         else
         {
             pid = atoi(T.argv[i]);
-            kill(pid, sig);
+            job_kill(jobs, pid, sig);
         }
     }
-    return 1;
+    return 0;
+}
+
+/* n bytes as "512B", "1.5K", "3.2M", ... */
+static void format_bytes(char *buf, size_t len, unsigned long long n)
+{
+    const char *unit = "BKMGTP";
+    double v = n;
+
+    while (v >= 1024 && unit[1])
+    {
+        v /= 1024;
+        unit++;
+    }
+    snprintf(buf, len, *unit == 'B' ? "%.0f%c" : "%.1f%c", v, *unit);
+}
+
+static void print_sample(const char *who, char state, const ProcSample *s, const char *where)
+{
+    char rss[16], rd[16], wr[16];
+
+    format_bytes(rss, sizeof(rss), s->rss);
+    format_bytes(rd, sizeof(rd), s->read);
+    format_bytes(wr, sizeof(wr), s->write);
+    printf("        %7s  %c  %5.1f  %8s  %8s  %8s  %s\n", who, state, s->cpu, rss, rd, wr, where);
+}
+
+/* jobs -v: what each process of job is using and where it runs, and the
+ * totals for its process group.  Returns the number of its processes
+ * that have not exited. */
+static int print_usage(Job *job)
+{
+    const ProcSample *s;
+    ProcSample total;
+    char pid[16], where[256];
+    unsigned int t;
+    int live = 0;
+
+    /* nothing started yet, e.g. the pipeline jobs itself is part of */
+    for (t = 0; t < job->npids && job->pids[t] <= 0; t++)
+        ;
+    if (t == job->npids)
+        return 0;
+
+    printf("        %7s  S   CPU%%       RSS      READ     WRITE  PLACEMENT\n", "PID");
+    for (t = 0; t < job->npids; t++)
+    {
+        if (job->pids[t] <= 0)
+            continue;
+
+        snprintf(pid, sizeof(pid), "%d", job->pids[t]);
+        if (!(s = monitor_proc(job->pids[t])))
+        {
+            printf("        %7s  -\n", pid);
+            continue;
+        }
+
+        place_describe(job->place, job->pids[t], where, sizeof(where));
+        print_sample(pid, s->state, s, where);
+        live += s->state != 'Z';
+    }
+
+    monitor_job(job, &total);
+    print_sample("group", ' ', &total, "");
+
+    return live;
 }
 
-void builtin_jobs(Job **jobs, int *job_ids)
+/* the job list; with verbose set, also what the jobs use.  Returns the
+ * number of processes the jobs have that have not exited (0 if not
+ * verbose). */
+static int print_jobs(JobTable *jobs, int verbose)
 {
     char *status;
+    Job *job;
+    int live = 0;
+
+    if (verbose)
+        monitor_begin();
 
     int i;
-    for (i = 0; i < 100; i++)
+    for (i = 0; i < jobs->next; i++)
     {
 
-        if (job_ids[i])
+        if ((job = job_get(jobs, i)))
         {
-            switch (jobs[i]->status)
+            switch (job->status)
             {
             case STOPPED:
                 status = "stopped";
@@ -166,103 +243,676 @@ void builtin_jobs(Job **jobs, int *job_ids)
             case FG:
                 status = "running";
                 break;
+            case DONE:
+                status = "done";
+                break;
             }
-            printf("[%d] + %s    %s\n", i, status, jobs[i]->name);
+            if (job->group >= 0)
+                printf("[%d] + %s    %s    (group %d)\n", i, status, job->name, job->group);
+            else
+                printf("[%d] + %s    %s\n", i, status, job->name);
+            if (verbose && job->status != DONE)
+                live += print_usage(job);
+        }
+    }
+
+    if (verbose)
+        monitor_end();
+    return live;
+}
+
+/* jobs -w: the jobs -v view, redrawn every interval seconds until a key
+ * is pressed or every process of every job has exited */
+static int watch_jobs(JobTable *jobs, double interval)
+{
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    struct termios saved, raw;
+    int tty = isatty(STDIN_FILENO) && !tcgetattr(STDIN_FILENO, &saved);
+    int live;
+    char c;
+
+    /* a key (^C included) ends it without waiting for Enter */
+    if (tty)
+    {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    for (;;)
+    {
+        if (tty)
+            printf("\033[H\033[2J");
+        live = print_jobs(jobs, 1);
+        printf(tty ? "\n(press any key to stop)\n" : "\n");
+        fflush(stdout);
+
+        if (!live)
+            break;
+        if (poll(tty ? &pfd : NULL, tty, interval * 1000) > 0)
+        {
+            read(STDIN_FILENO, &c, 1);
+            break;
         }
     }
+
+    if (tty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return 0;
+}
+
+int builtin_jobs(Task T, Parse *P, JobTable *jobs)
+{
+    double interval = 1;
+
+    if (!T.argv[1])
+        print_jobs(jobs, 0);
+    else if (!strcmp(T.argv[1], "-v") && !T.argv[2])
+        print_jobs(jobs, 1);
+    else if (!strcmp(T.argv[1], "-w") && (!T.argv[2] || ((interval = atof(T.argv[2])) > 0 && !T.argv[3])))
+        return watch_jobs(jobs, interval);
+    else
+    {
+        printf("Usage: jobs [-v | -w [seconds]]\n");
+        return 1;
+    }
+
+    return 0;
 }
-void builtin_fg(Task T, Job **jobs, int *job_ids)
+int builtin_fg(Task T, Parse *P, JobTable *jobs)
 {
     int argc = num_args(T);
     int jobno;
+    Job *job;
     if (argc != 2)
     {
         printf("Usage: fg %%<job number>\n");
+        return 1;
     }
     jobno = atoi(T.argv[1] + 1);
     if (T.argv[1][0] != '%')
     {
         printf("pssh: invalid job number: [%s]\n", T.argv[1]);
     }
-    else if (!is_valid_jobno(jobno, job_ids))
+    else if (!is_valid_jobno(jobno, jobs))
     {
         printf("pssh: invalid job number: [%s]\n", T.argv[1]);
     }
+    else if (job_get(jobs, jobno)->status == DONE)
+    {
+        printf("pssh: job has finished: [%s]\n", T.argv[1]);
+    }
     else
     {
-        if(jobs[jobno]->status == STOPPED)
+        job = job_get(jobs, jobno);
+        jobs->fg = job;
+        set_fg_pgrp(job->pgid);
+        if (job->demoted)
+            prio_job(job, 0);
+        if(job->status == STOPPED)
         {
-            jobs[jobno]->status = FG;
-            int i;
-            for (i = 0; i < jobs[jobno]->npids; i++)
-            {
-                kill(jobs[jobno]->pids[i], 18);
-            }
+            job_signal(job, SIGCONT);
         }
-
-        set_fg_pgrp(getpgid(jobs[jobno]->pids[0]));
+        job->status = FG;
+        return 0;
     }
+    return 1;
 }
 
-void builtin_bg(Task T, Job **jobs, int *job_ids)
+int builtin_bg(Task T, Parse *P, JobTable *jobs)
 {
     int argc = num_args(T);
     int jobno;
+    Job *job;
     if (argc != 2)
     {
         printf("Usage: bg %%<job number>\n");
+        return 1;
     }
     jobno = atoi(T.argv[1] + 1);
     if (T.argv[1][0] != '%')
     {
         printf("pssh: invalid job number: [%s]\n", T.argv[1]);
     }
-    else if (!is_valid_jobno(jobno, job_ids))
+    else if (!is_valid_jobno(jobno, jobs))
     {
         printf("pssh: invalid job number: [%s]\n", T.argv[1]);
     }
     else
     {
-        if(jobs[jobno]->status == STOPPED)
+        job = job_get(jobs, jobno);
+        if(job->status == STOPPED)
         {
-            jobs[jobno]->status = BG;   
-            int i;
-            for (i = 0; i < jobs[jobno]->npids; i++)
-            {
-                kill(jobs[jobno]->pids[i], 18);
-            }
+            job->status = BG;
+            if (!job->demoted)
+                prio_job(job, 1);
+            job_signal(job, SIGCONT);
         }
+        return 0;
     }
+    return 1;
 }
 
-void builtin_execute(Task T, Job **jobs, int *job_ids)
+int builtin_hash(Task T, Parse *P, JobTable *jobs)
 {
-    char *path;
-    if (!strcmp(T.cmd, "which"))
+    int i, status = 0;
+
+    if (!strcmp(T.cmd, "rehash"))
+    {
+        path_rehash();
+        return 0;
+    }
+
+    if (!T.argv[1])
     {
-        if (T.argv[1])
+        path_print();
+        return 0;
+    }
+
+    for (i = 1; T.argv[i]; i++)
+    {
+        if (!strcmp(T.argv[i], "-r"))
+            path_rehash();
+        else if (!is_builtin(T.argv[i]) && !path_lookup(T.argv[i]))
         {
-            if (is_builtin(T.argv[1]))
-            {
-                printf("%s: shell built-in command\n", T.argv[1]);
-            }
+            printf("pssh: hash: %s: not found\n", T.argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+int builtin_launch(Task T, Parse *P, JobTable *jobs)
+{
+    int rc;
+
+    if (!T.argv[1])
+        printf("%s\n", launch_mode_name(launch_mode));
+    else if (T.argv[2] || (rc = launch_set_mode(T.argv[1])) == -1)
+    {
+        printf("Usage: launch [fork|spawn|zygote]\n");
+        return 1;
+    }
+    else if (rc)
+        return 1;
+
+    return 0;
+}
+
+/* reads the items for 'parallel' one per line */
+static char **read_items(FILE *fp, unsigned int *nitems)
+{
+    char **items = NULL;
+    unsigned int n = 0, cap = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t r;
+
+    while ((r = getline(&line, &len, fp)) != -1)
+    {
+        if (r && line[r - 1] == '\n')
+            line[--r] = '\0';
+        if (!r)
+            continue;
+
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            items = realloc(items, cap * sizeof(*items));
+        }
+        items[n++] = strdup(line);
+    }
+
+    free(line);
+    *nitems = n;
+    return items;
+}
+
+static void parallel_done(ParallelSpec *spec, int failed)
+{
+    fprintf(stderr, "parallel: %u jobs in %.3fs (%.1f jobs/s), %d failed%s\n",
+            spec->nitems, spec->secs, spec->secs > 0 ? spec->nitems / spec->secs : 0.0,
+            failed, spec->interrupted ? ", interrupted" : "");
+    parallel_spec_free(spec);
+}
+
+/* parallel [-j N] [-k] [-a] cmd [args] {} ... ::: item ...
+ * parallel [-j N] [-k] [-a] cmd [args] {} ... < listfile
+ * Returns the number of items that failed (capped at 101), 2 on usage
+ * errors.  With a trailing & the run goes on in the background. */
+int builtin_parallel(Task T, Parse *P, JobTable *jobs)
+{
+    char *help_str = "Usage: parallel [-j N] [-k] [-a] command [args] [{}] ... (::: item ... | < listfile)\n";
+    ParallelSpec *spec;
+    char **argv = T.argv + 1;
+    char **sep, **items;
+    unsigned int i, nitems = 0, max_jobs = 0;
+    int keep_order = 0, aggregate = 0, failed;
+    FILE *fp = NULL;
+
+    for (; *argv && (*argv)[0] == '-'; argv++)
+    {
+        if (!strcmp(*argv, "-k"))
+            keep_order = 1;
+        else if (!strcmp(*argv, "-a"))
+            aggregate = 1;
+        else if (!strcmp(*argv, "-j") && argv[1] && atoi(argv[1]) > 0)
+            max_jobs = atoi(*++argv);
+        else
+        {
+            printf(help_str);
+            return 2;
+        }
+    }
+
+    for (sep = argv; *sep && strcmp(*sep, ":::"); sep++)
+        ;
+
+    if (sep == argv)
+    {
+        printf(help_str);
+        return 2;
+    }
+
+    if (*sep)
+    {
+        *sep = NULL;
+        for (items = sep + 1; items[nitems]; nitems++)
+            ;
+    }
+    else
+    {
+        if (P->infile)
+            fp = fopen(P->infile, "r");
+        else if (!isatty(STDIN_FILENO))
+            fp = fdopen(dup(STDIN_FILENO), "r");
+
+        if (!fp)
+        {
+            if (P->infile)
+                fprintf(stderr, "pssh: no such file or directory: %s\n", P->infile);
             else
-            {
-                path = command_found_builtin(T.argv[1]);
-                if (path)
-                {
-                    printf("%s\n", path);
-                    free(path);
-                }
-            }
+                printf(help_str);
+            return 2;
         }
+        items = read_items(fp, &nitems);
+        fclose(fp);
     }
-    else if (!strcmp(T.cmd, "bg"))
+
+    spec = parallel_spec_new(argv, items, nitems);
+    if (fp)
     {
-        printf("pssh: builtin command: %s (not implemented!)\n", T.cmd);
+        for (i = 0; i < nitems; i++)
+            free(items[i]);
+        free(items);
+    }
+
+    if (P->outfile && (spec->out = open(P->outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+    {
+        fprintf(stderr, "pssh: permission denied: %s\n", P->outfile);
+        spec->out = STDOUT_FILENO;
+    }
+
+    spec->max_jobs = max_jobs;
+    spec->keep_order = keep_order;
+    spec->aggregate = aggregate;
+    spec->background = P->background;
+    spec->done = parallel_done;
+
+    /* the shell's own buffered output must not end up after the items' */
+    fflush(stdout);
+
+    failed = parallel_run(spec, jobs);
+    return failed > 101 ? 101 : failed;
+}
+
+/* on [-p N] [-t secs] [-a] <host,host,...|@hostfile> command [args]
+ * Returns the number of hosts where the command did not succeed (capped
+ * at 101), 2 on usage errors.  With a trailing & it runs in the
+ * background. */
+int builtin_on(Task T, Parse *P, JobTable *jobs)
+{
+    char *help_str = "Usage: on [-p N] [-t secs] [-a] <host,...|@hostfile> command [args]\n";
+    char **argv = T.argv + 1;
+    char **hosts, *cmd;
+    unsigned int nhosts;
+    HostsOpts opts = {HOSTS_DEFAULT_POOL, 0, 0, 0};
+    int failed;
+
+    for (; *argv && (*argv)[0] == '-'; argv++)
+    {
+        if (!strcmp(*argv, "-a"))
+            opts.aggregate = 1;
+        else if (!strcmp(*argv, "-p") && argv[1] && atoi(argv[1]) > 0)
+            opts.pool = atoi(*++argv);
+        else if (!strcmp(*argv, "-t") && argv[1] && atof(argv[1]) > 0)
+            opts.timeout_ms = atof(*++argv) * 1000;
+        else
+        {
+            printf(help_str);
+            return 2;
+        }
     }
+
+    if (!argv[0] || !argv[1])
+    {
+        printf(help_str);
+        return 2;
+    }
+
+    if (!(hosts = hosts_group(argv[0], &nhosts)))
+    {
+        fprintf(stderr, "pssh: on: %s: %s\n", argv[0] + 1, strerror(errno));
+        return 2;
+    }
+
+    opts.background = P->background;
+    cmd = parallel_join(argv + 1);
+    failed = hosts_run(hosts, nhosts, cmd, &opts, jobs);
+    free(cmd);
+    hosts_free(hosts, nhosts);
+
+    return failed > 101 ? 101 : failed;
+}
+
+int builtin_which(Task T, Parse *P, JobTable *jobs)
+{
+    const char *path;
+    int i, status = 0;
+
+    for (i = 1; T.argv[i]; i++)
+    {
+        if (is_builtin(T.argv[i]))
+        {
+            printf("%s: shell built-in command\n", T.argv[i]);
+        }
+        else if ((path = path_lookup(T.argv[i])))
+        {
+            printf("%s\n", path);
+        }
+        else
+        {
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+int builtin_cd(Task T, Parse *P, JobTable *jobs)
+{
+    const char *dir = T.argv[1];
+
+    if (dir && T.argv[2])
+    {
+        printf("Usage: cd [dir | -]\n");
+        return 1;
+    }
+
+    if (!dir && !(dir = env_get("HOME")))
+    {
+        fprintf(stderr, "pssh: cd: HOME not set\n");
+        return 1;
+    }
+
+    if (!strcmp(dir, "-") && !(dir = env_get("OLDPWD")))
+    {
+        fprintf(stderr, "pssh: cd: OLDPWD not set\n");
+        return 1;
+    }
+
+    if (cwd_change(dir) == -1)
+    {
+        fprintf(stderr, "pssh: cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    if (!strcmp(T.argv[1] ? T.argv[1] : "", "-"))
+        printf("%s\n", cwd_get());
+
+    return 0;
+}
+
+/* reports a failed pushd or popd; rc is what cwd_push()/cwd_pop() returned */
+static int dirs_failed(const char *cmd, const char *dir, int rc)
+{
+    if (rc == -2)
+        fprintf(stderr, "pssh: %s: directory stack empty\n", cmd);
+    else if (dir)
+        fprintf(stderr, "pssh: %s: %s: %s\n", cmd, dir, strerror(errno));
+    else
+        fprintf(stderr, "pssh: %s: %s\n", cmd, strerror(errno));
+
+    return 1;
+}
+
+int builtin_pushd(Task T, Parse *P, JobTable *jobs)
+{
+    int rc;
+
+    if (T.argv[1] && T.argv[2])
+    {
+        printf("Usage: pushd [dir]\n");
+        return 1;
+    }
+
+    if ((rc = cwd_push(T.argv[1])))
+        return dirs_failed("pushd", T.argv[1], rc);
+
+    cwd_print_stack();
+    return 0;
+}
+
+int builtin_popd(Task T, Parse *P, JobTable *jobs)
+{
+    int rc;
+
+    if (T.argv[1])
+    {
+        printf("Usage: popd\n");
+        return 1;
+    }
+
+    if ((rc = cwd_pop()))
+        return dirs_failed("popd", NULL, rc);
+
+    cwd_print_stack();
+    return 0;
+}
+
+int builtin_dirs(Task T, Parse *P, JobTable *jobs)
+{
+    cwd_print_stack();
+    return 0;
+}
+
+int builtin_history(Task T, Parse *P, JobTable *jobs)
+{
+    if (!T.argv[1])
+        history_print_last(16);
+    else if ((!strcmp(T.argv[1], "-p") || !strcmp(T.argv[1], "-s")) && T.argv[2] && !T.argv[3])
+        history_find(T.argv[2], T.argv[1][1] == 'p');
+    else if (atoi(T.argv[1]) > 0 && !T.argv[2])
+        history_print_last(atoi(T.argv[1]));
     else
+    {
+        printf("Usage: history [n] | -p prefix | -s text\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int builtin_export(Task T, Parse *P, JobTable *jobs)
+{
+    const char *eq;
+    int i, status = 0;
+
+    if (!T.argv[1])
+    {
+        env_print();
+        return 0;
+    }
+
+    for (i = 1; T.argv[i]; i++)
+    {
+        eq = strchr(T.argv[i], '=');
+        if (!env_valid_name(T.argv[i], eq ? eq - T.argv[i] : strlen(T.argv[i])))
+        {
+            fprintf(stderr, "pssh: export: %s: not a valid name\n", T.argv[i]);
+            status = 1;
+        }
+        else if (eq)
+            env_put(T.argv[i], 1);
+        else
+            env_export(T.argv[i]);
+    }
+
+    return status;
+}
+
+int builtin_unset(Task T, Parse *P, JobTable *jobs)
+{
+    int i;
+
+    if (!T.argv[1])
+    {
+        printf("Usage: unset name ...\n");
+        return 1;
+    }
+
+    for (i = 1; T.argv[i]; i++)
+        env_unset(T.argv[i]);
+
+    return 0;
+}
+
+/* pin <cpulist|nodeN|auto> %job; the pipeline form is a prefix that
+ * pssh.c takes off before the job is started */
+int builtin_pin(Task T, Parse *P, JobTable *jobs)
+{
+    Placement *place;
+    unsigned int t;
+    Job *job;
+    int jobno;
+
+    if (!T.argv[1] || !T.argv[2] || T.argv[3] || T.argv[2][0] != '%')
+    {
+        printf("Usage: pin <cpulist|nodeN|auto> pipeline | pin <cpulist|nodeN|auto> %%<job number>\n");
+        return 1;
+    }
+
+    jobno = atoi(T.argv[2] + 1);
+    if (!is_valid_jobno(jobno, jobs) || (job = job_get(jobs, jobno))->status == DONE)
+    {
+        printf("pssh: invalid job number: [%s]\n", T.argv[2]);
+        return 1;
+    }
+
+    if (!(place = place_new(T.argv[1])))
+    {
+        fprintf(stderr, "pssh: pin: %s: no such CPUs or node\n", T.argv[1]);
+        return 1;
+    }
+
+    /* stages that have already exited are gone with ESRCH */
+    for (t = 0; t < job->npids; t++)
+    {
+        if (job->pids[t] > 0 && place_apply(place, t, job->pids[t]) == -1 && errno != ESRCH)
+        {
+            fprintf(stderr, "pssh: pin: %d: %s\n", job->pids[t], strerror(errno));
+            free(place);
+            return 1;
+        }
+    }
+
+    free(job->place);
+    job->place = place;
+    return 0;
+}
+
+int builtin_renice(Task T, Parse *P, JobTable *jobs)
+{
+    char *end;
+    long nice;
+    Job *job;
+    int jobno;
+
+    if (!T.argv[1] || !T.argv[2] || T.argv[3] || T.argv[2][0] != '%' ||
+        (nice = strtol(T.argv[1], &end, 10), *end || end == T.argv[1]))
+    {
+        printf("Usage: renice <nice> %%<job number>\n");
+        return 1;
+    }
+
+    jobno = atoi(T.argv[2] + 1);
+    if (!is_valid_jobno(jobno, jobs) || (job = job_get(jobs, jobno))->status == DONE)
+    {
+        printf("pssh: invalid job number: [%s]\n", T.argv[2]);
+        return 1;
+    }
+
+    if (prio_renice(job, nice) == -1)
+    {
+        fprintf(stderr, "pssh: renice: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* trace [on [file] | off]: without arguments, shows the file being
+ * traced to.  The file defaults to pssh-<pid>.trace.json. */
+int builtin_trace(Task T, Parse *P, JobTable *jobs)
+{
+    char path[64];
+    const char *file;
+
+    if (!T.argv[1])
+    {
+        if (trace_path())
+            printf("tracing to %s\n", trace_path());
+        else
+            printf("off\n");
+        return 0;
+    }
+
+    if (!strcmp(T.argv[1], "off") && !T.argv[2])
+    {
+        trace_stop();
+        return 0;
+    }
+
+    if (strcmp(T.argv[1], "on") || (T.argv[2] && T.argv[3]))
+    {
+        printf("Usage: trace [on [file] | off]\n");
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "pssh-%d.trace.json", (int)getpid());
+    file = T.argv[2] ? T.argv[2] : path;
+    if (trace_start(file) == -1)
+    {
+        fprintf(stderr, "pssh: trace: %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* runs builtin T.cmd in the calling process and returns its exit status */
+int builtin_execute(Task T, Parse *P, JobTable *jobs)
+{
+    Builtin *b = find_builtin(T.cmd);
+
+    if (!b || !b->run)
     {
         printf("pssh: builtin command: %s (not implemented!)\n", T.cmd);
+        return 1;
     }
+
+    return b->run(T, P, jobs);
 }
@@ -4,13 +4,32 @@
 #include "parse.h"
 #include "jobs.h"
 
+/* flags of a builtin */
+#define BUILTIN_SHELL   1   /* acts on the shell itself, so never runs in a pipeline */
+#define BUILTIN_OWN_IO  2   /* opens its < and > files itself */
+
 int is_builtin (char* cmd);
-void builtin_execute (Task T, Job **jobs, int *job_ids);
-int builtin_which (Task T);
-void builtin_jobs(Job **jobs, int *job_ids);
-int is_valid_jobno(int jobno, int *job_ids);
-int builtin_kill(Task T, Job **jobs, int *job_ids);
-void builtin_fg(Task T, Job **jobs, int *job_ids);
-void builtin_bg(Task T, Job **jobs, int *job_ids);
-char *command_found_builtin(const char *cmd);
+const char *builtin_name(int i);
+int builtin_flags(char *cmd);
+int builtin_execute(Task T, Parse *P, JobTable *jobs);
+int builtin_which(Task T, Parse *P, JobTable *jobs);
+int builtin_jobs(Task T, Parse *P, JobTable *jobs);
+int is_valid_jobno(int jobno, JobTable *jobs);
+int builtin_kill(Task T, Parse *P, JobTable *jobs);
+int builtin_fg(Task T, Parse *P, JobTable *jobs);
+int builtin_bg(Task T, Parse *P, JobTable *jobs);
+int builtin_hash(Task T, Parse *P, JobTable *jobs);
+int builtin_launch(Task T, Parse *P, JobTable *jobs);
+int builtin_parallel(Task T, Parse *P, JobTable *jobs);
+int builtin_on(Task T, Parse *P, JobTable *jobs);
+int builtin_cd(Task T, Parse *P, JobTable *jobs);
+int builtin_pushd(Task T, Parse *P, JobTable *jobs);
+int builtin_popd(Task T, Parse *P, JobTable *jobs);
+int builtin_dirs(Task T, Parse *P, JobTable *jobs);
+int builtin_history(Task T, Parse *P, JobTable *jobs);
+int builtin_export(Task T, Parse *P, JobTable *jobs);
+int builtin_unset(Task T, Parse *P, JobTable *jobs);
+int builtin_pin(Task T, Parse *P, JobTable *jobs);
+int builtin_renice(Task T, Parse *P, JobTable *jobs);
+int builtin_trace(Task T, Parse *P, JobTable *jobs);
 #endif /* _builtin_h_ */
@@ -0,0 +1,348 @@
+/* Tab completion.
+ *
+ * A command word (the first word of the line or of a pipeline stage)
+ * completes from a trie of the builtins and every executable in the
+ * PATH directories; any other word falls through to readline's filename
+ * completion.
+ *
+ * Reading the PATH directories is left to a worker thread, which builds
+ * the trie when the shell starts and is asked to look again on every
+ * completion.  It keeps the names it found in each directory with the
+ * directory's mtime and only reads a directory again when that mtime
+ * has changed (or it has left PATH), then applies the difference to the
+ * trie under trie_lock; the directories themselves are read without the
+ * lock held, so a completion never waits for the filesystem and answers
+ * from what the trie holds at that moment. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "complete.h"
+#include "builtin.h"
+#include "env.h"
+
+/* first-child, next-sibling trie; siblings are kept in byte order */
+typedef struct Node
+{
+    struct Node *child;
+    struct Node *next;
+    unsigned int count;     /* sources (PATH directories, builtins) with this name */
+    char c;
+} Node;
+
+/* a PATH directory as the worker last read it */
+typedef struct
+{
+    char *name;
+    struct timespec mtime;
+    char **names;           /* executables found in it */
+    unsigned int nnames;
+    int stamped;            /* it has been read */
+    int seen;               /* still in PATH */
+} ExecDir;
+
+static pthread_mutex_t trie_lock = PTHREAD_MUTEX_INITIALIZER;
+static Node root;
+
+/* the worker's own */
+static ExecDir *dirs;
+static unsigned int ndirs;
+
+/* requests for the worker: the PATH to bring the trie up to date with */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static char *wanted;
+
+/* matches handed out one at a time by command_generator() */
+static char **matches;
+static unsigned int nmatches, next_match, matches_cap;
+
+static Node *trie_child(Node *n, char c, int create)
+{
+    Node **p, *child;
+
+    for (p = &n->child; *p && (unsigned char)(*p)->c < (unsigned char)c; p = &(*p)->next)
+        ;
+    if (*p && (*p)->c == c)
+        return *p;
+    if (!create)
+        return NULL;
+
+    child = calloc(1, sizeof(*child));
+    child->c = c;
+    child->next = *p;
+    *p = child;
+    return child;
+}
+
+/* names that disappear keep their nodes, with a count of 0; the trie
+ * only grows with the number of distinct names ever seen */
+static void trie_add(const char *s, int delta)
+{
+    Node *n = &root;
+
+    for (; *s && n; s++)
+        n = trie_child(n, *s, delta > 0);
+
+    if (n)
+        n->count += delta;
+}
+
+static void add_match(const char *s, size_t len)
+{
+    if (nmatches == matches_cap)
+    {
+        matches_cap = matches_cap ? matches_cap * 2 : 64;
+        matches = realloc(matches, matches_cap * sizeof(*matches));
+    }
+    matches[nmatches++] = strndup(s, len);
+}
+
+/* every name below n; buf holds the len bytes of the path to n */
+static void collect(Node *n, char *buf, size_t len, size_t cap)
+{
+    if (n->count)
+        add_match(buf, len);
+
+    if (len + 1 >= cap)
+        return;
+
+    for (n = n->child; n; n = n->next)
+    {
+        buf[len] = n->c;
+        collect(n, buf, len + 1, cap);
+    }
+}
+
+static int is_exec(int dfd, const char *name)
+{
+    struct stat st;
+
+    return !fstatat(dfd, name, &st, 0) && S_ISREG(st.st_mode) && (st.st_mode & 0111);
+}
+
+/* makes names the executables in d, in the trie and in d */
+static void set_names(ExecDir *d, char **names, unsigned int n)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&trie_lock);
+    for (i = 0; i < d->nnames; i++)
+        trie_add(d->names[i], -1);
+    for (i = 0; i < n; i++)
+        trie_add(names[i], 1);
+    pthread_mutex_unlock(&trie_lock);
+
+    for (i = 0; i < d->nnames; i++)
+        free(d->names[i]);
+    free(d->names);
+    d->names = names;
+    d->nnames = n;
+}
+
+static void read_dir(ExecDir *d)
+{
+    char **names = NULL;
+    unsigned int n = 0, cap = 0;
+    struct dirent *ent;
+    DIR *dp;
+
+    if ((dp = opendir(d->name)))
+    {
+        while ((ent = readdir(dp)))
+        {
+            if (ent->d_name[0] == '.' || ent->d_type == DT_DIR || !is_exec(dirfd(dp), ent->d_name))
+                continue;
+
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 256;
+                names = realloc(names, cap * sizeof(*names));
+            }
+            names[n++] = strdup(ent->d_name);
+        }
+        closedir(dp);
+    }
+
+    set_names(d, names, n);
+}
+
+static ExecDir *find_dir(const char *name, size_t len)
+{
+    unsigned int i;
+
+    for (i = 0; i < ndirs; i++)
+    {
+        if (!strncmp(dirs[i].name, name, len) && !dirs[i].name[len])
+            return &dirs[i];
+    }
+
+    dirs = realloc(dirs, (ndirs + 1) * sizeof(*dirs));
+    memset(&dirs[ndirs], 0, sizeof(*dirs));
+    dirs[ndirs].name = strndup(name, len);
+    return &dirs[ndirs++];
+}
+
+/* brings the trie up to date with the directories in path */
+static void refresh(const char *path)
+{
+    const char *s, *colon;
+    struct stat st;
+    unsigned int i;
+    ExecDir *d;
+
+    for (i = 0; i < ndirs; i++)
+        dirs[i].seen = 0;
+
+    /* relative entries depend on the cwd, and are left out */
+    for (s = path; s; s = colon ? colon + 1 : NULL)
+    {
+        colon = strchr(s, ':');
+        if (*s != '/')
+            continue;
+
+        d = find_dir(s, colon ? colon - s : strlen(s));
+        if (d->seen)
+            continue;
+        d->seen = 1;
+
+        if (stat(d->name, &st) == -1)
+            memset(&st, 0, sizeof(st));
+        if (d->stamped && st.st_mtim.tv_sec == d->mtime.tv_sec &&
+            st.st_mtim.tv_nsec == d->mtime.tv_nsec)
+            continue;
+
+        d->mtime = st.st_mtim;
+        d->stamped = 1;
+        read_dir(d);
+    }
+
+    for (i = 0; i < ndirs;)
+    {
+        if (dirs[i].seen)
+        {
+            i++;
+            continue;
+        }
+
+        /* it has left PATH */
+        set_names(&dirs[i], NULL, 0);
+        free(dirs[i].name);
+        dirs[i] = dirs[--ndirs];
+    }
+}
+
+static void *complete_worker(void *arg)
+{
+    char *path;
+
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        while (!wanted)
+            pthread_cond_wait(&wake, &lock);
+        path = wanted;
+        wanted = NULL;
+        pthread_mutex_unlock(&lock);
+
+        refresh(path);
+        free(path);
+
+        pthread_mutex_lock(&lock);
+    }
+
+    return NULL;
+}
+
+/* asks the worker to check PATH for changes */
+static void complete_refresh(void)
+{
+    const char *path = env_get("PATH");
+
+    pthread_mutex_lock(&lock);
+    free(wanted);
+    wanted = strdup(path ? path : "");
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+static char *command_generator(const char *text, int state)
+{
+    char buf[256];
+    size_t len = strlen(text);
+    const char *s;
+    Node *n = &root;
+
+    if (!state)
+    {
+        while (next_match < nmatches)
+            free(matches[next_match++]);
+        nmatches = next_match = 0;
+
+        if (len < sizeof(buf))
+        {
+            pthread_mutex_lock(&trie_lock);
+            for (s = text; *s && n; s++)
+                n = trie_child(n, *s, 0);
+            if (n)
+            {
+                memcpy(buf, text, len);
+                collect(n, buf, len, sizeof(buf));
+            }
+            pthread_mutex_unlock(&trie_lock);
+        }
+    }
+
+    /* readline frees what it is given */
+    return next_match < nmatches ? matches[next_match++] : NULL;
+}
+
+/* readline's hook: command words from the trie, the rest as files */
+static char **complete_hook(const char *text, int start, int end)
+{
+    int i = start;
+
+    while (i && (rl_line_buffer[i - 1] == ' ' || rl_line_buffer[i - 1] == '\t'))
+        i--;
+    if ((i && rl_line_buffer[i - 1] != '|') || strchr(text, '/'))
+        return NULL;
+
+    complete_refresh();
+    rl_attempted_completion_over = 1;
+    return rl_completion_matches(text, command_generator);
+}
+
+/* installs the completion hook and starts reading PATH in the background */
+void complete_init(void)
+{
+    pthread_attr_t attr;
+    pthread_t worker;
+    sigset_t all, old;
+    const char *name;
+    int i;
+
+    for (i = 0; (name = builtin_name(i)); i++)
+        trie_add(name, 1);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&worker, &attr, complete_worker, NULL))
+    {
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        return;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    rl_attempted_completion_function = complete_hook;
+    complete_refresh();
+}
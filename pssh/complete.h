@@ -0,0 +1,6 @@
+#ifndef _complete_h_
+#define _complete_h_
+
+void complete_init(void);
+
+#endif /* _complete_h_ */
@@ -0,0 +1,128 @@
+/* The shell's working directory and the pushd/popd stack.
+ *
+ * Only the shell itself can change its cwd, and only through cd, pushd
+ * and popd, so the canonical path is looked up once at startup and once
+ * after every successful chdir() and then served from here: the prompt
+ * and the zygote read it without another getcwd().  A generation number
+ * goes up on every change so the prompt can tell when it is stale. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "cwd.h"
+#include "env.h"
+
+static char cwd[PATH_MAX];
+static int cwd_known;
+static unsigned int generation;
+
+/* directories saved by pushd, the most recent last */
+static char **stack;
+static unsigned int nstack, stack_cap;
+
+/* the canonical cwd; "" if it cannot be found (it has been removed) */
+const char *cwd_get(void)
+{
+    if (!cwd_known)
+    {
+        if (!getcwd(cwd, sizeof(cwd)))
+            cwd[0] = '\0';
+        else
+            env_set("PWD", cwd, 1);
+        cwd_known = 1;
+    }
+
+    return cwd;
+}
+
+/* goes up every time the cwd changes */
+unsigned int cwd_generation(void)
+{
+    return generation;
+}
+
+/* chdir() to dir and update the cache, $PWD and $OLDPWD.
+ * Returns -1 with errno set if dir cannot be entered. */
+int cwd_change(const char *dir)
+{
+    char old[PATH_MAX];
+
+    strcpy(old, cwd_get());
+    if (chdir(dir) == -1)
+        return -1;
+
+    /* getcwd() only fails here if dir was removed from under us */
+    if (!getcwd(cwd, sizeof(cwd)))
+        snprintf(cwd, sizeof(cwd), "%s", dir);
+
+    if (old[0])
+        env_set("OLDPWD", old, 1);
+    env_set("PWD", cwd, 1);
+    generation++;
+
+    return 0;
+}
+
+static void stack_push(const char *dir)
+{
+    if (nstack == stack_cap)
+    {
+        stack_cap = stack_cap ? stack_cap * 2 : 8;
+        stack = realloc(stack, stack_cap * sizeof(*stack));
+    }
+    stack[nstack++] = strdup(dir);
+}
+
+/* pushd: save the cwd and change to dir, or with no dir swap the cwd
+ * with the top of the stack.  Returns -1 with errno set if the new
+ * directory cannot be entered, -2 if there is nothing to swap with. */
+int cwd_push(const char *dir)
+{
+    char old[PATH_MAX];
+
+    strcpy(old, cwd_get());
+
+    if (!dir)
+    {
+        if (!nstack)
+            return -2;
+        if (cwd_change(stack[nstack - 1]) == -1)
+            return -1;
+
+        free(stack[nstack - 1]);
+        stack[nstack - 1] = strdup(old);
+        return 0;
+    }
+
+    if (cwd_change(dir) == -1)
+        return -1;
+
+    stack_push(old);
+    return 0;
+}
+
+/* popd: change back to the top of the stack and drop it.  Returns -1
+ * with errno set if it cannot be entered, -2 if the stack is empty. */
+int cwd_pop(void)
+{
+    if (!nstack)
+        return -2;
+    if (cwd_change(stack[nstack - 1]) == -1)
+        return -1;
+
+    free(stack[--nstack]);
+    return 0;
+}
+
+/* prints the cwd followed by the stack, most recent first */
+void cwd_print_stack(void)
+{
+    unsigned int i;
+
+    printf("%s", cwd_get());
+    for (i = nstack; i > 0; i--)
+        printf(" %s", stack[i - 1]);
+    printf("\n");
+}
@@ -0,0 +1,11 @@
+#ifndef _cwd_h_
+#define _cwd_h_
+
+const char *cwd_get(void);
+unsigned int cwd_generation(void);
+int cwd_change(const char *dir);
+int cwd_push(const char *dir);
+int cwd_pop(void);
+void cwd_print_stack(void);
+
+#endif /* _cwd_h_ */
@@ -0,0 +1,326 @@
+/* Shell variables and the environment handed to commands.
+ *
+ * Every variable lives in one hash table keyed by its name, stored as the
+ * "NAME=value" string a child's environment needs; exported variables
+ * are the ones that go into it.  The envp vector is only built again when
+ * an exported variable has changed since the last one was handed out, so
+ * launching command after command with the same environment costs nothing
+ * here.  The vector is also made the process's environ, for the libc
+ * functions that read it.
+ *
+ * Strings the current vector points to are not freed when their variable
+ * changes, only once the next vector has replaced it.
+ *
+ * 'NAME=value cmd' does not touch the table: env_overlay() hands back a
+ * vector of pointers to the same strings with the overrides in place of
+ * (or after) the entries they replace. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "env.h"
+
+#define INITIAL_BUCKETS 64
+
+extern char **environ;
+
+typedef struct var
+{
+    char *pair;             /* "NAME=value", or NULL if it is exported but unset */
+    size_t len;             /* of NAME */
+    int exported;
+    struct var *next;
+} Var;
+
+static Var **buckets;
+static unsigned int nbuckets;
+static unsigned int nvars;
+
+static char **vector;       /* exported pairs, NULL terminated */
+static int dirty = 1;       /* vector is out of date */
+
+/* replaced pairs vector may still point to */
+static char **stale;
+static unsigned int nstale, stale_cap;
+
+static unsigned int hash_mem(const char *s, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    while (len--)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* the name of v: the front of its pair, or kept after v if it has none */
+static const char *var_name(Var *v)
+{
+    return v->pair ? v->pair : (const char *)(v + 1);
+}
+
+static void grow_buckets(void)
+{
+    unsigned int n = nbuckets ? nbuckets * 2 : INITIAL_BUCKETS;
+    unsigned int i, h;
+    Var **nb = calloc(n, sizeof(*nb));
+    Var *v, *next;
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (v = buckets[i]; v; v = next)
+        {
+            next = v->next;
+            h = hash_mem(var_name(v), v->len) & (n - 1);
+            v->next = nb[h];
+            nb[h] = v;
+        }
+    }
+
+    free(buckets);
+    buckets = nb;
+    nbuckets = n;
+}
+
+static Var **find(const char *name, size_t len)
+{
+    Var **p;
+
+    if (!nbuckets)
+        return NULL;
+
+    for (p = &buckets[hash_mem(name, len) & (nbuckets - 1)]; *p; p = &(*p)->next)
+        if ((*p)->len == len && !memcmp(var_name(*p), name, len))
+            return p;
+
+    return NULL;
+}
+
+static Var *insert(const char *name, size_t len)
+{
+    Var *v;
+    unsigned int h;
+
+    if (nvars + 1 > nbuckets - nbuckets / 4)
+        grow_buckets();
+
+    /* room for the name, for while it is unset */
+    v = malloc(sizeof(*v) + len + 1);
+    memcpy(v + 1, name, len);
+    ((char *)(v + 1))[len] = '\0';
+    v->pair = NULL;
+    v->len = len;
+    v->exported = 0;
+
+    h = hash_mem(name, len) & (nbuckets - 1);
+    v->next = buckets[h];
+    buckets[h] = v;
+    nvars++;
+
+    return v;
+}
+
+/* frees the pair of v, or keeps it until the vector it is in is replaced */
+static void retire(Var *v)
+{
+    if (!v->exported)
+    {
+        free(v->pair);
+        return;
+    }
+
+    dirty = 1;
+    if (nstale == stale_cap)
+    {
+        stale_cap = stale_cap ? stale_cap * 2 : 16;
+        stale = realloc(stale, stale_cap * sizeof(*stale));
+    }
+    stale[nstale++] = v->pair;
+}
+
+/* 1 if [s, s+len) is a valid variable name */
+int env_valid_name(const char *s, size_t len)
+{
+    size_t i;
+
+    if (!len || isdigit((unsigned char)*s))
+        return 0;
+
+    for (i = 0; i < len; i++)
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_')
+            return 0;
+
+    return 1;
+}
+
+/* loads the environment the shell was started with */
+void env_init(void)
+{
+    char **e;
+    const char *eq;
+
+    for (e = environ; *e; e++)
+        if ((eq = strchr(*e, '=')) && eq != *e)
+            env_put(*e, 1);
+}
+
+/* the value of the variable named by the len bytes at name, or NULL */
+const char *env_getn(const char *name, size_t len)
+{
+    Var **p = find(name, len);
+
+    return p && (*p)->pair ? (*p)->pair + len + 1 : NULL;
+}
+
+const char *env_get(const char *name)
+{
+    return env_getn(name, strlen(name));
+}
+
+/* sets the variable pair is the "NAME=value" of; it is exported if
+ * export is set or it already was */
+void env_put(const char *pair, int export)
+{
+    size_t len = strchr(pair, '=') - pair;
+    Var **p = find(pair, len);
+    Var *v = p ? *p : insert(pair, len);
+
+    if (v->pair)
+    {
+        if (!strcmp(v->pair, pair) && (v->exported || !export))
+            return;
+        retire(v);
+    }
+
+    v->pair = strdup(pair);
+    v->exported |= export;
+    if (v->exported)
+        dirty = 1;
+}
+
+void env_set(const char *name, const char *value, int export)
+{
+    size_t len = strlen(name), vlen = strlen(value);
+    char *pair = malloc(len + vlen + 2);
+
+    memcpy(pair, name, len);
+    pair[len] = '=';
+    memcpy(pair + len + 1, value, vlen + 1);
+    env_put(pair, export);
+    free(pair);
+}
+
+/* marks name for export; if it is unset it is exported once it is set */
+void env_export(const char *name)
+{
+    size_t len = strlen(name);
+    Var **p = find(name, len);
+    Var *v = p ? *p : insert(name, len);
+
+    if (v->exported)
+        return;
+
+    v->exported = 1;
+    if (v->pair)
+        dirty = 1;
+}
+
+void env_unset(const char *name)
+{
+    Var **p = find(name, strlen(name));
+    Var *v;
+
+    if (!p)
+        return;
+
+    v = *p;
+    *p = v->next;
+    nvars--;
+
+    if (v->pair)
+        retire(v);
+    free(v);
+}
+
+/* the environment for a command, NULL terminated.  It stays valid until
+ * the next change to an exported variable is followed by another call. */
+char **env_vector(void)
+{
+    unsigned int i, n = 0;
+    char **old = vector;
+    Var *v;
+
+    if (!dirty)
+        return vector;
+
+    vector = malloc((nvars + 1) * sizeof(*vector));
+    for (i = 0; i < nbuckets; i++)
+        for (v = buckets[i]; v; v = v->next)
+            if (v->exported && v->pair)
+                vector[n++] = v->pair;
+    vector[n] = NULL;
+    environ = vector;
+    free(old);
+
+    while (nstale)
+        free(stale[--nstale]);
+    dirty = 0;
+
+    return vector;
+}
+
+static int same_name(const char *a, const char *b)
+{
+    while (*a != '=' && *a == *b)
+        a++, b++;
+
+    return *a == '=' && *b == '=';
+}
+
+/* the environment with the n "NAME=value" strings in assigns layered on
+ * top, allocated from A.  Only pointers are copied; with several for the
+ * same name the last one wins. */
+char **env_overlay(Arena *A, char **assigns, unsigned int n)
+{
+    char **base = env_vector(), **envp, **e;
+    unsigned int i, j, count = 0;
+
+    for (e = base; *e; e++)
+        count++;
+    envp = arena_alloc(A, (count + n + 1) * sizeof(*envp));
+
+    for (count = 0, e = base; *e; e++)
+    {
+        for (i = 0; i < n && !same_name(*e, assigns[i]); i++)
+            ;
+        if (i == n)
+            envp[count++] = *e;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        for (j = i + 1; j < n && !same_name(assigns[i], assigns[j]); j++)
+            ;
+        if (j == n)
+            envp[count++] = assigns[i];
+    }
+    envp[count] = NULL;
+
+    return envp;
+}
+
+/* lists the exported variables as the commands that would set them */
+void env_print(void)
+{
+    char **e;
+    const char *eq;
+
+    for (e = env_vector(); *e; e++)
+    {
+        eq = strchr(*e, '=');
+        printf("export %.*s='%s'\n", (int)(eq - *e), *e, eq + 1);
+    }
+}
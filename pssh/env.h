@@ -0,0 +1,19 @@
+#ifndef _env_h_
+#define _env_h_
+
+#include <stddef.h>
+#include "arena.h"
+
+void env_init(void);
+int env_valid_name(const char *s, size_t len);
+const char *env_get(const char *name);
+const char *env_getn(const char *name, size_t len);
+void env_put(const char *pair, int export);
+void env_set(const char *name, const char *value, int export);
+void env_export(const char *name);
+void env_unset(const char *name);
+char **env_vector(void);
+char **env_overlay(Arena *A, char **assigns, unsigned int n);
+void env_print(void);
+
+#endif /* _env_h_ */
@@ -0,0 +1,9 @@
+#ifndef _glob_h_
+#define _glob_h_
+
+#include "arena.h"
+#include "parse.h"
+
+void glob_expand(Arena *A, Parse *P);
+
+#endif /* _glob_h_ */
@@ -0,0 +1,649 @@
+/* Command history.
+ *
+ * Every line typed at the prompt is appended to the history file
+ * ($PSSH_HISTFILE, or ~/.pssh_history) as "time<TAB>line\n" with one
+ * write() on an O_APPEND descriptor under flock(), so sessions running at
+ * the same time interleave whole lines and the file is never rewritten.
+ *
+ * At startup the file is only mmap'd, and the last HISTORY_LOAD lines are
+ * found by walking back from the end and handed to readline for the arrow
+ * keys and ^R; that costs the same for ten lines as for a million.
+ *
+ * The index behind the history builtin is built by a thread started
+ * right after that, so the prompt never waits for it, and is brought up
+ * to date from where it left off whenever the file has grown, by this
+ * session or another one.  A search made before the thread is done waits
+ * for it.  The index has one entry
+ * per distinct line, pointing at its latest copy in the map, with how
+ * often and when it was last run; a hash table finds the entry for a
+ * line and an array of the entries sorted by text answers prefix
+ * searches by binary search.
+ *
+ * Substring searches go through a trigram index: for every three byte
+ * sequence, the entries that contain it.  A search only looks at the
+ * entries of the rarest trigram of its text, so its cost follows the
+ * number of lines that could match rather than the size of the history.
+ * Texts shorter than a trigram are matched against every entry. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/history.h>
+
+#include "history.h"
+#include "env.h"
+
+#define HISTORY_LOAD 1000   /* lines given to readline at startup */
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+typedef struct
+{
+    size_t off;         /* of the text of its latest copy in the file */
+    unsigned int len;
+    unsigned int hash;
+    unsigned int count;
+    time_t last;
+} HistEntry;
+
+/* the map and the index, shared with the indexing thread */
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hist_fd = -1;
+static char *map;
+static size_t map_len;
+static size_t indexed;      /* bytes of the map that have been indexed */
+
+static HistEntry *entries;
+static unsigned int nentries, entries_cap;
+static unsigned int *buckets;   /* entry index + 1, 0 if free */
+static unsigned int nbuckets;
+/* entries in order of their text; key holds the first 8 bytes of it, so
+ * most comparisons never have to touch the map */
+typedef struct
+{
+    unsigned long long key;
+    unsigned int entry;
+} SortKey;
+
+static SortKey *sorted;
+static unsigned int nsorted;
+
+/* the trigram index: open addressing on the trigram */
+typedef struct
+{
+    unsigned int gram;      /* its three bytes + 1; 0 marks a free slot */
+    unsigned int n, cap;
+    unsigned int *ids;      /* entries that contain it, in increasing order */
+} Gram;
+
+static Gram *grams;
+static unsigned int ngrams, gram_slots;
+
+#define TEXT(e) (map + (e)->off)
+
+/* drops the whole index, to be built again from the start of the file */
+static void forget_index(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < gram_slots; i++)
+        free(grams[i].ids);
+    free(grams);
+    free(entries);
+    free(buckets);
+    free(sorted);
+
+    grams = NULL;
+    entries = NULL;
+    buckets = NULL;
+    sorted = NULL;
+    nentries = entries_cap = nbuckets = nsorted = ngrams = gram_slots = 0;
+    indexed = 0;
+}
+
+/* maps the file as far as it has been written.  If it has got shorter
+ * (it was truncated or replaced) the index is thrown away, since the
+ * lines it points at are gone. */
+static int hist_map(void)
+{
+    struct stat st;
+    char *m = NULL;
+
+    if (hist_fd == -1 || fstat(hist_fd, &st) == -1)
+        return -1;
+    if ((size_t)st.st_size == map_len)
+        return 0;
+
+    if (st.st_size && (m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist_fd, 0)) == MAP_FAILED)
+        return -1;
+    if (map)
+        munmap(map, map_len);
+    if ((size_t)st.st_size < map_len)
+        forget_index();
+    map = m;
+    map_len = st.st_size;
+
+    return 0;
+}
+
+/* splits the line at map[start..end) into time and text; returns NULL
+ * if it is not a history line */
+static const char *split_line(size_t start, size_t end, time_t *t)
+{
+    const char *p;
+
+    for (*t = 0, p = map + start; p < map + end && *p >= '0' && *p <= '9'; p++)
+        *t = *t * 10 + (*p - '0');
+
+    if (p == map + end || *p != '\t' || p + 1 == map + end)
+        return NULL;
+
+    return p + 1;
+}
+
+static unsigned int hash_text(const char *s, size_t len)
+{
+    unsigned int h = FNV_OFFSET;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+static void grow_buckets(void)
+{
+    unsigned int i, h;
+
+    free(buckets);
+    nbuckets = nbuckets ? nbuckets * 2 : 1024;
+    buckets = calloc(nbuckets, sizeof(*buckets));
+
+    for (i = 0; i < nentries; i++)
+    {
+        for (h = entries[i].hash & (nbuckets - 1); buckets[h]; h = (h + 1) & (nbuckets - 1))
+            ;
+        buckets[h] = i + 1;
+    }
+}
+
+static unsigned int gram_at(const char *s)
+{
+    return ((unsigned char)s[0] << 16 | (unsigned char)s[1] << 8 | (unsigned char)s[2]) + 1;
+}
+
+static Gram *gram_slot(Gram *table, unsigned int slots, unsigned int gram)
+{
+    unsigned int h;
+
+    for (h = (gram * 2654435761u) & (slots - 1); table[h].gram && table[h].gram != gram; h = (h + 1) & (slots - 1))
+        ;
+    return &table[h];
+}
+
+static void grow_grams(void)
+{
+    unsigned int n = gram_slots ? gram_slots * 2 : 4096, i;
+    Gram *table = calloc(n, sizeof(*table));
+
+    for (i = 0; i < gram_slots; i++)
+        if (grams[i].gram)
+            *gram_slot(table, n, grams[i].gram) = grams[i];
+
+    free(grams);
+    grams = table;
+    gram_slots = n;
+}
+
+/* the postings of gram, or NULL if no entry has it */
+static Gram *find_gram(unsigned int gram)
+{
+    Gram *g;
+
+    if (!gram_slots)
+        return NULL;
+
+    g = gram_slot(grams, gram_slots, gram);
+    return g->gram ? g : NULL;
+}
+
+/* adds entry i to the postings of each trigram of its text */
+static void index_grams(unsigned int i)
+{
+    const HistEntry *e = &entries[i];
+    const char *t = TEXT(e);
+    unsigned int p, gram;
+    Gram *g;
+
+    for (p = 0; p + 3 <= e->len; p++)
+    {
+        if ((ngrams + 1) * 2 > gram_slots)
+            grow_grams();
+
+        gram = gram_at(t + p);
+        g = gram_slot(grams, gram_slots, gram);
+        if (!g->gram)
+        {
+            g->gram = gram;
+            ngrams++;
+        }
+
+        /* entries are added in order, so a repeat in this text is last */
+        if (g->n && g->ids[g->n - 1] == i)
+            continue;
+        if (g->n == g->cap)
+        {
+            g->cap = g->cap ? g->cap * 2 : 4;
+            g->ids = realloc(g->ids, g->cap * sizeof(*g->ids));
+        }
+        g->ids[g->n++] = i;
+    }
+}
+
+static void index_line(size_t start, size_t end)
+{
+    const char *text;
+    HistEntry *e;
+    unsigned int h, hash, len;
+    time_t t;
+
+    if (!(text = split_line(start, end, &t)))
+        return;
+
+    len = map + end - text;
+    hash = hash_text(text, len);
+
+    for (h = hash & (nbuckets - 1); buckets[h]; h = (h + 1) & (nbuckets - 1))
+    {
+        e = &entries[buckets[h] - 1];
+        if (e->hash == hash && e->len == len && !memcmp(TEXT(e), text, len))
+        {
+            e->off = text - map;
+            e->count++;
+            e->last = t;
+            return;
+        }
+    }
+
+    if (nentries == entries_cap)
+    {
+        entries_cap = entries_cap ? entries_cap * 2 : 1024;
+        entries = realloc(entries, entries_cap * sizeof(*entries));
+        sorted = realloc(sorted, entries_cap * sizeof(*sorted));
+    }
+
+    e = &entries[nentries];
+    e->off = text - map;
+    e->len = len;
+    e->hash = hash;
+    e->count = 1;
+    e->last = t;
+    buckets[h] = ++nentries;
+    index_grams(nentries - 1);
+
+    if (nentries * 2 > nbuckets)
+        grow_buckets();
+}
+
+static int text_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+
+    return c ? c : (alen > blen) - (alen < blen);
+}
+
+static unsigned long long sort_key(const char *s, size_t len)
+{
+    unsigned long long key = 0;
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+        key = key << 8 | (i < len ? (unsigned char)s[i] : 0);
+
+    return key;
+}
+
+static SortKey make_key(unsigned int i)
+{
+    SortKey k = {sort_key(TEXT(&entries[i]), entries[i].len), i};
+
+    return k;
+}
+
+static int key_cmp(const SortKey *a, const SortKey *b)
+{
+    const HistEntry *x = &entries[a->entry], *y = &entries[b->entry];
+
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+
+    return text_cmp(TEXT(x), x->len, TEXT(y), y->len);
+}
+
+static int sort_cmp(const void *a, const void *b)
+{
+    return key_cmp(a, b);
+}
+
+/* first position in sorted[] whose text is not less than s */
+static unsigned int lower_bound(const char *s, size_t len)
+{
+    unsigned int lo = 0, hi = nsorted, mid;
+    unsigned long long key = sort_key(s, len);
+    HistEntry *e;
+    int c;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        e = &entries[sorted[mid].entry];
+        if (sorted[mid].key != key)
+            c = sorted[mid].key < key ? -1 : 1;
+        else
+            c = text_cmp(TEXT(e), e->len, s, len);
+
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* indexes whatever has been appended to the file since the last call */
+static void hist_catch_up(void)
+{
+    size_t start, first;
+    unsigned int i, pos;
+    char *nl;
+    HistEntry *e;
+
+    /* which may start the index over */
+    if (hist_map() == -1)
+        return;
+    first = nentries;
+
+    if (!nbuckets)
+        grow_buckets();
+
+    /* a line is only complete once its newline is there */
+    for (start = indexed; start < map_len && (nl = memchr(map + start, '\n', map_len - start)); start = indexed)
+    {
+        index_line(start, nl - map);
+        indexed = nl - map + 1;
+    }
+
+    if (nentries - first > 64)
+    {
+        for (i = first; i < nentries; i++)
+            sorted[nsorted++] = make_key(i);
+        qsort(sorted, nsorted, sizeof(*sorted), sort_cmp);
+        return;
+    }
+
+    for (i = first; i < nentries; i++)
+    {
+        e = &entries[i];
+        pos = lower_bound(TEXT(e), e->len);
+        memmove(sorted + pos + 1, sorted + pos, (nsorted - pos) * sizeof(*sorted));
+        sorted[pos] = make_key(i);
+        nsorted++;
+    }
+}
+
+static void *hist_indexer(void *arg)
+{
+    pthread_mutex_lock(&index_lock);
+    hist_catch_up();
+    pthread_mutex_unlock(&index_lock);
+
+    return NULL;
+}
+
+/* a child forked while the indexer was busy cannot wait for it: it
+ * starts over with an empty index (and leaks the old one) */
+static void hist_forked(void)
+{
+    if (!pthread_mutex_trylock(&index_lock))
+    {
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+
+    pthread_mutex_init(&index_lock, NULL);
+    map = NULL;
+    map_len = indexed = 0;
+    entries = NULL;
+    buckets = NULL;
+    sorted = NULL;
+    grams = NULL;
+    nentries = entries_cap = nbuckets = nsorted = ngrams = gram_slots = 0;
+}
+
+/* opens the history file, gives readline its most recent lines and
+ * starts indexing the rest */
+void history_init(void)
+{
+    pthread_attr_t attr;
+    pthread_t indexer;
+    sigset_t all, old;
+    char path[PATH_MAX], *line = NULL;
+    size_t starts[HISTORY_LOAD], end, p, cap = 0;
+    const char *text;
+    unsigned int n, len;
+    time_t t;
+
+    if (env_get("PSSH_HISTFILE"))
+        snprintf(path, sizeof(path), "%s", env_get("PSSH_HISTFILE"));
+    else if (env_get("HOME"))
+        snprintf(path, sizeof(path), "%s/.pssh_history", env_get("HOME"));
+    else
+        return;
+
+    using_history();
+    stifle_history(HISTORY_LOAD);
+
+    if ((hist_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        return;
+    if (hist_map() == -1 || !map_len)
+        return;
+
+    /* back from the last complete line, remembering where lines start */
+    for (end = map_len; end && map[end - 1] != '\n'; end--)
+        ;
+    for (n = 0, p = end; p && n < HISTORY_LOAD; n++)
+    {
+        for (p--; p && map[p - 1] != '\n'; p--)
+            ;
+        starts[n] = p;
+    }
+
+    while (n--)
+    {
+        for (p = starts[n]; map[p] != '\n'; p++)
+            ;
+        if (!(text = split_line(starts[n], p, &t)))
+            continue;
+
+        len = map + p - text;
+        if (len + 1 > cap)
+        {
+            cap = len + 1;
+            line = realloc(line, cap);
+        }
+        memcpy(line, text, len);
+        line[len] = '\0';
+
+        if (!history_length || strcmp(history_get(history_base + history_length - 1)->line, line))
+            add_history(line);
+    }
+
+    free(line);
+
+    pthread_atfork(NULL, NULL, hist_forked);
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&indexer, &attr, hist_indexer, NULL);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* records a line typed at the prompt */
+void history_add(const char *line)
+{
+    size_t size;
+    char *rec;
+    int n;
+
+    line += strspn(line, " \t");
+    if (!*line)
+        return;
+
+    if (!history_length || strcmp(history_get(history_base + history_length - 1)->line, line))
+        add_history(line);
+
+    if (hist_fd == -1)
+        return;
+
+    size = strlen(line) + 32;
+    rec = malloc(size);
+    n = snprintf(rec, size, "%ld\t%s\n", (long)time(NULL), line);
+
+    flock(hist_fd, LOCK_EX);
+    write(hist_fd, rec, n);
+    flock(hist_fd, LOCK_UN);
+    free(rec);
+}
+
+/* prints the last n lines of the history, from every session */
+void history_print_last(unsigned int n)
+{
+    size_t stop, end, p;
+    const char *text;
+    time_t t;
+
+    pthread_mutex_lock(&index_lock);
+    if (hist_map() == -1 || !map_len)
+    {
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+
+    for (stop = map_len; stop && map[stop - 1] != '\n'; stop--)
+        ;
+    for (p = stop; p && n; n--)
+        for (p--; p && map[p - 1] != '\n'; p--)
+            ;
+
+    for (; p < stop; p = end + 1)
+    {
+        for (end = p; map[end] != '\n'; end++)
+            ;
+        if ((text = split_line(p, end, &t)))
+            printf("%.*s\n", (int)(map + end - text), text);
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+static int by_last(const void *a, const void *b)
+{
+    const HistEntry *x = &entries[*(const unsigned int *)a];
+    const HistEntry *y = &entries[*(const unsigned int *)b];
+
+    return (x->last > y->last) - (x->last < y->last);
+}
+
+static int contains(const HistEntry *e, const char *s, size_t len)
+{
+    const char *p = TEXT(e), *end = TEXT(e) + e->len;
+
+    for (; p + len <= end; p++)
+    {
+        if (*p == *s && !memcmp(p, s, len))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* prints the distinct lines that start with (prefix) or contain text,
+ * least recently run first, with how many times each was run */
+void history_find(const char *text, int prefix)
+{
+    unsigned int *found, nfound = 0, i;
+    size_t len = strlen(text);
+    HistEntry *e;
+    Gram *g, *best;
+
+    pthread_mutex_lock(&index_lock);
+    hist_catch_up();
+    if (!nentries)
+    {
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+
+    found = malloc(nentries * sizeof(*found));
+    if (prefix)
+    {
+        for (i = lower_bound(text, len); i < nsorted; i++)
+        {
+            e = &entries[sorted[i].entry];
+            if (e->len < len || memcmp(TEXT(e), text, len))
+                break;
+            found[nfound++] = sorted[i].entry;
+        }
+    }
+    else if (len >= 3)
+    {
+        /* every match has all the trigrams: check those of the rarest */
+        for (best = NULL, i = 0; i + 3 <= len; i++)
+        {
+            if (!(g = find_gram(gram_at(text + i))))
+                break;
+            if (!best || g->n < best->n)
+                best = g;
+        }
+
+        for (i = 0; g && i < best->n; i++)
+        {
+            if (contains(&entries[best->ids[i]], text, len))
+                found[nfound++] = best->ids[i];
+        }
+    }
+    else
+    {
+        for (i = 0; i < nentries; i++)
+        {
+            if (contains(&entries[i], text, len))
+                found[nfound++] = i;
+        }
+    }
+
+    qsort(found, nfound, sizeof(*found), by_last);
+    for (i = 0; i < nfound; i++)
+    {
+        e = &entries[found[i]];
+        printf("%6u  %.*s\n", e->count, (int)e->len, TEXT(e));
+    }
+
+    free(found);
+    pthread_mutex_unlock(&index_lock);
+}
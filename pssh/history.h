@@ -0,0 +1,9 @@
+#ifndef _history_h_
+#define _history_h_
+
+void history_init(void);
+void history_add(const char *line);
+void history_print_last(unsigned int n);
+void history_find(const char *text, int prefix);
+
+#endif /* _history_h_ */
@@ -0,0 +1,265 @@
+/* Multi-host fan-out: runs one command on many hosts at once.
+ *
+ * Nothing here talks to a host directly.  Each host gets its own copy of
+ * a transport command, $PSSH_TRANSPORT or plain ssh by default, in which
+ * {host} and {cmd} are replaced by the host name and the command line.
+ * A local stand-in such as
+ *
+ *     PSSH_TRANSPORT='sh -c {cmd} {host}'
+ *
+ * runs the command locally once per "host" (with the host in $0).
+ *
+ * The transports are run by the parallel runner, which bounds how many
+ * connections are open at once, kills the ones that overstay the timeout
+ * and streams every host's output line by line with the host name in
+ * front.  A summary of exit codes and latencies follows at the end. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "hosts.h"
+#include "parallel.h"
+#include "env.h"
+
+#define DEFAULT_TRANSPORT "ssh -o BatchMode=yes {host} {cmd}"
+
+static void add_host(char ***hosts, unsigned int *n, unsigned int *cap,
+                     const char *name, size_t len)
+{
+    if (*n == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        *hosts = realloc(*hosts, *cap * sizeof(**hosts));
+    }
+    (*hosts)[(*n)++] = strndup(name, len);
+}
+
+/* one host per line; blank lines and anything after a # are ignored.
+ * Returns NULL if the file cannot be read. */
+char **hosts_load(const char *file, unsigned int *nhosts)
+{
+    char **hosts = NULL;
+    unsigned int cap = 0;
+    char *line = NULL, *s, *e;
+    size_t len = 0;
+    FILE *fp;
+
+    *nhosts = 0;
+    if (!(fp = fopen(file, "r")))
+        return NULL;
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        if ((e = strchr(line, '#')))
+            *e = '\0';
+        for (s = line; isspace((unsigned char)*s); s++)
+            ;
+        for (e = s; *e && !isspace((unsigned char)*e); e++)
+            ;
+        if (e > s)
+            add_host(&hosts, nhosts, &cap, s, e - s);
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (!hosts)
+        hosts = malloc(sizeof(*hosts));
+    return hosts;
+}
+
+/* a host group is either @hostfile or a comma separated list of hosts */
+char **hosts_group(const char *group, unsigned int *nhosts)
+{
+    char **hosts = NULL;
+    unsigned int cap = 0;
+    const char *s, *e;
+
+    if (group[0] == '@')
+        return hosts_load(group + 1, nhosts);
+
+    *nhosts = 0;
+    for (s = group; *s; s = *e ? e + 1 : e)
+    {
+        if (!(e = strchr(s, ',')))
+            e = s + strlen(s);
+        if (e > s)
+            add_host(&hosts, nhosts, &cap, s, e - s);
+    }
+
+    if (!hosts)
+        hosts = malloc(sizeof(*hosts));
+    return hosts;
+}
+
+void hosts_free(char **hosts, unsigned int nhosts)
+{
+    unsigned int i;
+
+    for (i = 0; i < nhosts; i++)
+        free(hosts[i]);
+    free(hosts);
+}
+
+/* the transport split into words, with {cmd} already filled in; {host}
+ * is left for the runner to replace per host */
+static char **transport_argv(const char *cmd)
+{
+    const char *tmpl = env_get("PSSH_TRANSPORT");
+    char **argv;
+    unsigned int n = 0;
+    char *word;
+    const char *s, *e;
+
+    if (!tmpl || !*tmpl)
+        tmpl = DEFAULT_TRANSPORT;
+
+    /* no more words than characters */
+    argv = malloc((strlen(tmpl) + 1) * sizeof(*argv));
+
+    for (s = tmpl; *s; s = e)
+    {
+        while (isspace((unsigned char)*s))
+            s++;
+        for (e = s; *e && !isspace((unsigned char)*e); e++)
+            ;
+        if (e == s)
+            break;
+
+        word = strndup(s, e - s);
+        argv[n++] = parallel_subst(word, "{cmd}", cmd);
+        free(word);
+    }
+    argv[n] = NULL;
+
+    return argv;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of the n sorted values in v */
+static double percentile(double *v, unsigned int n, unsigned int p)
+{
+    unsigned int rank = (p * n + 99) / 100;
+
+    return v[rank ? rank - 1 : 0];
+}
+
+/* failed hosts, grouped by exit status */
+static void print_failures(ParallelSpec *spec)
+{
+    ParallelResult *res;
+    unsigned int i, j, n;
+    int *seen = calloc(spec->nitems + 1, sizeof(*seen));
+
+    for (i = 0; i < spec->nitems; i++)
+    {
+        res = &spec->results[i];
+        if (seen[i] || !res->finished || (!res->status && !res->timed_out))
+            continue;
+
+        for (n = 0, j = i; j < spec->nitems; j++)
+            if (spec->results[j].finished &&
+                spec->results[j].timed_out == res->timed_out &&
+                spec->results[j].status == res->status)
+                n++;
+
+        if (res->timed_out)
+            fprintf(stderr, "  timed out (%u):", n);
+        else
+            fprintf(stderr, "  exit %d (%u):", res->status, n);
+
+        for (j = i; j < spec->nitems; j++)
+        {
+            if (spec->results[j].finished &&
+                spec->results[j].timed_out == res->timed_out &&
+                spec->results[j].status == res->status)
+            {
+                seen[j] = 1;
+                fprintf(stderr, " %s", spec->items[j]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    free(seen);
+}
+
+static void print_summary(ParallelSpec *spec)
+{
+    ParallelResult *res;
+    unsigned int i, ok = 0, failed = 0, timed_out = 0, n = 0;
+    double *secs = malloc((spec->nitems + 1) * sizeof(*secs));
+
+    for (i = 0; i < spec->nitems; i++)
+    {
+        res = &spec->results[i];
+        if (!res->finished)
+            continue;
+
+        secs[n++] = res->secs;
+        if (res->timed_out)
+            timed_out++;
+        else if (res->status)
+            failed++;
+        else
+            ok++;
+    }
+
+    print_failures(spec);
+    fprintf(stderr, "on: %u hosts in %.3fs: %u ok, %u failed, %u timed out",
+            spec->nitems, spec->secs, ok, failed, timed_out);
+    if (n < spec->nitems)
+        fprintf(stderr, ", %u not run", spec->nitems - n);
+    fprintf(stderr, "\n");
+
+    if (n)
+    {
+        qsort(secs, n, sizeof(*secs), cmp_double);
+        fprintf(stderr, "latency: min %.3fs  p50 %.3fs  p90 %.3fs  p99 %.3fs  max %.3fs\n",
+                secs[0], percentile(secs, n, 50), percentile(secs, n, 90),
+                percentile(secs, n, 99), secs[n - 1]);
+    }
+
+    free(secs);
+}
+
+static void hosts_done(ParallelSpec *spec, int failed)
+{
+    print_summary(spec);
+    parallel_spec_free(spec);
+}
+
+/* runs cmd on every host, at most opts->pool at a time, and returns the
+ * number of hosts where it failed, timed out or was never run (0 right
+ * away for a background run, which summarizes when it is over) */
+int hosts_run(char **hosts, unsigned int nhosts, const char *cmd,
+              HostsOpts *opts, JobTable *jobs)
+{
+    ParallelSpec *spec;
+    char **argv = transport_argv(cmd);
+    unsigned int i;
+
+    spec = parallel_spec_new(argv, hosts, nhosts);
+    for (i = 0; argv[i]; i++)
+        free(argv[i]);
+    free(argv);
+
+    spec->placeholder = "{host}";
+    spec->max_jobs = opts->pool ? opts->pool : HOSTS_DEFAULT_POOL;
+    spec->prefix = !opts->aggregate;
+    spec->aggregate = opts->aggregate;
+    spec->timeout_ms = opts->timeout_ms;
+    spec->background = opts->background;
+    spec->done = hosts_done;
+
+    fflush(stdout);
+    return parallel_run(spec, jobs);
+}
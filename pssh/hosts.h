@@ -0,0 +1,22 @@
+#ifndef _hosts_h_
+#define _hosts_h_
+
+#include "jobs.h"
+
+#define HOSTS_DEFAULT_POOL 32
+
+typedef struct
+{
+    unsigned int pool;      /* connections open at once */
+    int timeout_ms;         /* per host, 0 for none */
+    int aggregate;          /* group identical outputs instead of streaming */
+    int background;         /* return at once, summarize at the end */
+} HostsOpts;
+
+char **hosts_load(const char *file, unsigned int *nhosts);
+char **hosts_group(const char *group, unsigned int *nhosts);
+void hosts_free(char **hosts, unsigned int nhosts);
+int hosts_run(char **hosts, unsigned int nhosts, const char *cmd,
+              HostsOpts *opts, JobTable *jobs);
+
+#endif /* _hosts_h_ */
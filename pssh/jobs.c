@@ -3,9 +3,12 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/pidfd.h>
 
 #include "jobs.h"
 #include "parse.h"
+#include "loop.h"
+#include "trace.h"
 
 Job *new_job(char *name, Parse *P)
 {
@@ -13,10 +16,22 @@ Job *new_job(char *name, Parse *P)
     job->name = malloc(strlen(name) + 1);
     strcpy(job->name, name);
     job->npids = P->ntasks;
-    job->pids = malloc(sizeof(pid_t) * P->ntasks);
+    job->pids = calloc(P->ntasks, sizeof(pid_t));
+    job->pidfds = malloc(sizeof(int) * P->ntasks);
+    memset(job->pidfds, -1, sizeof(int) * P->ntasks);
     job->completed = 0;
     job->continued = 0;
     job->suspended = 0;
+    job->pgid = 0;
+    job->jid = -1;
+    job->exit_status = 0;
+    job->group = -1;
+    job->done = NULL;
+    job->done_ctx = NULL;
+    job->timing = NULL;
+    job->place = NULL;
+    job->nice = 0;
+    job->demoted = 0;
 
     if (P->background)
         job->status = BG;
@@ -25,43 +40,229 @@ Job *new_job(char *name, Parse *P)
 
     return job;
 }
-int next_jid(int *job_ids)
+static unsigned int pid_hash(pid_t pid, unsigned int cap)
 {
-    int i;
-    for (i = 0; i < 100; i++)
+    return ((unsigned int)pid * 2654435761u) & (cap - 1);
+}
+
+static void index_put(JobTable *jt, pid_t pid, int jid)
+{
+    unsigned int h = pid_hash(pid, jt->index_cap);
+
+    while (jt->index[h].pid && jt->index[h].pid != pid)
+        h = (h + 1) & (jt->index_cap - 1);
+
+    if (!jt->index[h].pid)
+        jt->index_used++;
+
+    jt->index[h].pid = pid;
+    jt->index[h].jid = jid;
+}
+
+static void index_grow(JobTable *jt)
+{
+    PidSlot *old = jt->index;
+    unsigned int i, cap = jt->index_cap;
+
+    jt->index_cap = cap ? cap * 2 : 64;
+    jt->index = calloc(jt->index_cap, sizeof(*jt->index));
+    jt->index_used = 0;
+
+    for (i = 0; i < cap; i++)
+        if (old[i].pid)
+            index_put(jt, old[i].pid, old[i].jid);
+
+    free(old);
+}
+
+/* backward shift deletion keeps probe chains intact without tombstones */
+static void index_del(JobTable *jt, pid_t pid)
+{
+    unsigned int mask = jt->index_cap - 1;
+    unsigned int h, i, home;
+
+    if (!jt->index_cap)
+        return;
+
+    for (h = pid_hash(pid, jt->index_cap); jt->index[h].pid != pid; h = (h + 1) & mask)
+        if (!jt->index[h].pid)
+            return;
+
+    for (i = (h + 1) & mask; jt->index[i].pid; i = (i + 1) & mask)
     {
-        if (!job_ids[i])
+        home = pid_hash(jt->index[i].pid, jt->index_cap);
+        if (((i - home) & mask) >= ((i - h) & mask))
         {
-            job_ids[i]++;
-            return i;
+            jt->index[h] = jt->index[i];
+            h = i;
         }
     }
+    jt->index[h].pid = 0;
+    jt->index_used--;
+}
+
+/* released ids are kept in a min-heap so the lowest free id is reused
+ * first, as it was with the old fixed-size table */
+static void free_id_push(JobTable *jt, int jid)
+{
+    unsigned int i = jt->nfree++;
+    int tmp;
+
+    jt->free_ids[i] = jid;
+    while (i && jt->free_ids[(i - 1) / 2] > jt->free_ids[i])
+    {
+        tmp = jt->free_ids[(i - 1) / 2];
+        jt->free_ids[(i - 1) / 2] = jt->free_ids[i];
+        jt->free_ids[i] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static int free_id_pop(JobTable *jt)
+{
+    unsigned int i = 0, c;
+    int top = jt->free_ids[0], tmp;
+
+    jt->free_ids[0] = jt->free_ids[--jt->nfree];
+    while ((c = 2 * i + 1) < jt->nfree)
+    {
+        if (c + 1 < jt->nfree && jt->free_ids[c + 1] < jt->free_ids[c])
+            c++;
+        if (jt->free_ids[i] <= jt->free_ids[c])
+            break;
+        tmp = jt->free_ids[c];
+        jt->free_ids[c] = jt->free_ids[i];
+        jt->free_ids[i] = tmp;
+        i = c;
+    }
+    return top;
+}
+
+static int next_jid(JobTable *jt)
+{
+    if (jt->nfree)
+        return free_id_pop(jt);
+
+    if (jt->next == jt->nslots)
+    {
+        jt->nslots = jt->nslots ? jt->nslots * 2 : 16;
+        jt->slots = realloc(jt->slots, jt->nslots * sizeof(*jt->slots));
+        jt->free_ids = realloc(jt->free_ids, jt->nslots * sizeof(*jt->free_ids));
+        memset(jt->slots + jt->next, 0, (jt->nslots - jt->next) * sizeof(*jt->slots));
+    }
+
+    return jt->next++;
+}
+
+/* adds job to the table and returns its job id */
+int job_insert(JobTable *jt, Job *job)
+{
+    job->jid = next_jid(jt);
+    jt->slots[job->jid] = job;
+
+    return job->jid;
+}
+
+Job *job_get(JobTable *jt, int jid)
+{
+    if (jid < 0 || jid >= jt->next)
+        return NULL;
+
+    return jt->slots[jid];
+}
+
+/* records pid as the i-th process of job and opens a pidfd for it, which
+ * is watched by jt->exited.  The pid cannot be recycled before the shell
+ * reaps it, so there is no race between the fork and pidfd_open(). */
+void job_add_pid(JobTable *jt, Job *job, unsigned int i, pid_t pid)
+{
+    job->pids[i] = pid;
+    if (pid <= 0)
+        return;
+
+    if ((job->pidfds[i] = pidfd_open(pid, 0)) == -1)
+        jt->untracked = 1;
+    else
+        loop_add(job->pidfds[i], jt->exited, job);
+
+    if ((jt->index_used + 1) * 4 > jt->index_cap * 3)
+        index_grow(jt);
+
+    index_put(jt, pid, job->jid);
+}
+
+int find_jid(JobTable *jt, pid_t pid)
+{
+    unsigned int h;
+
+    if (!jt->index_cap)
+        return -1;
+
+    for (h = pid_hash(pid, jt->index_cap); jt->index[h].pid; h = (h + 1) & (jt->index_cap - 1))
+        if (jt->index[h].pid == pid)
+            return jt->index[h].jid;
+
     return -1;
 }
 
-int find_jid(Job **jobs, pid_t pid)
+
+/* sends sig to every process of job, through its pidfds when it has them */
+void job_signal(Job *job, int sig)
+{
+    unsigned int i;
+
+    /* its pids may belong to someone else by now */
+    if (job->status == DONE)
+        return;
+
+    for (i = 0; i < job->npids; i++)
+    {
+        if (job->pidfds[i] == -1 || pidfd_send_signal(job->pidfds[i], sig, NULL, 0) == -1)
+            kill(job->pids[i], sig);
+    }
+}
+
+/* a finished job that stays listed until free_job_safe().  Its pids are
+ * reaped and may be reused, so they leave the index, and its pidfds are
+ * closed. */
+void job_retire(JobTable *jt, Job *job)
 {
-    int i, j;
-    for (i = 0; i < 100; i++)
+    unsigned int i;
+
+    for (i = 0; i < job->npids; i++)
     {
-        if (!jobs[i])
-            continue;
-        for (j = 0; j < jobs[i]->npids; j++)
+        if (job->pids[i] > 0)
+            index_del(jt, job->pids[i]);
+        if (job->pidfds[i] != -1)
         {
-            if (jobs[i]->pids[j] == pid)
-            {
-                return i;
-            }
+            loop_del(job->pidfds[i]);
+            close(job->pidfds[i]);
+            job->pidfds[i] = -1;
         }
     }
-    return -1;
+
+    job->status = DONE;
 }
 
+/* signals a single pid; if it belongs to a job, its pidfd is used so a
+ * recycled pid is never hit */
+int job_kill(JobTable *jt, pid_t pid, int sig)
+{
+    Job *job = job_get(jt, find_jid(jt, pid));
+    unsigned int i;
 
-void print_bg_job(Job *job, int jid)
+    if (job)
+        for (i = 0; i < job->npids; i++)
+            if (job->pids[i] == pid && job->pidfds[i] != -1)
+                return pidfd_send_signal(job->pidfds[i], sig, NULL, 0);
+
+    return kill(pid, sig);
+}
+
+void print_bg_job(Job *job)
 {
     int i;
-    printf("[%d] ", jid);
+    printf("[%d] ", job->jid);
     for (i = 0; i < job->npids; i++)
     {
         printf("%d ", job->pids[i]);
@@ -71,6 +272,7 @@ void print_bg_job(Job *job, int jid)
 
 void set_fg_pgrp(pid_t pgrp)
 {
+    unsigned long long span = trace_begin();
     void (*sav)(int sig);
 
     if (pgrp == 0)
@@ -79,22 +281,46 @@ void set_fg_pgrp(pid_t pgrp)
     sav = signal(SIGTTOU, SIG_IGN);
     tcsetpgrp(STDOUT_FILENO, pgrp);
     signal(SIGTTOU, sav);
+    trace_end(span, "tcsetpgrp", NULL, "pgrp", pgrp);
 }
 
 void free_job(Job *job)
 {
+    unsigned int i;
+
+    for (i = 0; i < job->npids; i++)
+    {
+        if (job->pidfds[i] != -1)
+        {
+            loop_del(job->pidfds[i]);
+            close(job->pidfds[i]);
+        }
+    }
+
+    timing_free(job->timing);
+    free(job->place);
     free(job->name);
     free(job->pids);
+    free(job->pidfds);
     free(job);
 }
 
-void free_job_safe(Job **jobs, Job *job, int *job_ids)
+void free_job_safe(JobTable *jt, Job *job)
 {
-    int job_id = find_jid(jobs, job->pids[0]);
-    free_job(job);
-    if (job_id != -1)
+    unsigned int i;
+
+    if (job->status != DONE)
+        for (i = 0; i < job->npids; i++)
+            if (job->pids[i] > 0)
+                index_del(jt, job->pids[i]);
+
+    if (jt->fg == job)
+        jt->fg = NULL;
+
+    if (jt->slots[job->jid] == job)
     {
-        job_ids[job_id] = 0;
-        jobs[job_id] = NULL;
+        jt->slots[job->jid] = NULL;
+        free_id_push(jt, job->jid);
     }
-}
\ No newline at end of file
+    free_job(job);
+}
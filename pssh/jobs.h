@@ -3,6 +3,9 @@
 
 #include <fcntl.h>
 #include "parse.h"
+#include "loop.h"
+#include "timing.h"
+#include "place.h"
 
 typedef enum
 {
@@ -10,27 +13,68 @@ typedef enum
     TERM,
     BG,
     FG,
+    DONE,       /* finished, but kept in the table by its owner */
 } JobStatus;
 typedef struct
 {
     char *name;
     pid_t *pids;
+    int *pidfds;        /* pidfds[i] refers to pids[i], -1 if unavailable */
     int completed;
     int continued;
     int suspended;
     unsigned int npids;
     pid_t pgid;
     JobStatus status;
+    int jid;
+    int exit_status;    /* of the last process in the pipeline */
+    int group;          /* output group in an aggregated run, or -1 */
+    /* called once all pids are reaped; returns 1 if it keeps the job
+     * (see job_retire()) rather than letting it be freed */
+    int (*done)(void *ctx, int status);
+    void *done_ctx;
+    PipelineTime *timing; /* set by the 'time' prefix, else NULL */
+    Placement *place;   /* set by 'pin', else NULL */
+    int nice;           /* set by 'renice': added to the shell's nice value */
+    int demoted;        /* has the background priority class (prio.c) */
 } Job;
 
+typedef struct
+{
+    pid_t pid;          /* 0 marks an empty slot */
+    int jid;
+} PidSlot;
+
+/* Jobs indexed by job id, plus a pid -> job id hash so a child's state
+ * change can be mapped back to its job without scanning the table */
+typedef struct
+{
+    Job **slots;        /* slots[jid], NULL when the id is unused */
+    unsigned int nslots;
+    unsigned int next;  /* lowest id that has never been handed out */
+    int *free_ids;      /* released ids (min-heap), reused before next */
+    unsigned int nfree;
+    PidSlot *index;     /* open addressing, linear probing */
+    unsigned int index_cap;
+    unsigned int index_used;
+    Job *fg;            /* job that currently owns the terminal, if any */
+    int untracked;      /* some child has no pidfd; reap exits via SIGCHLD */
+    LoopCallback exited; /* registered with the loop for every child's pidfd */
+} JobTable;
+
 Job *new_job(char *name, Parse *P);
-int next_jid(int *job_ids);
-int find_jid(Job *jobs[], pid_t pid);
+int job_insert(JobTable *jt, Job *job);
+Job *job_get(JobTable *jt, int jid);
+void job_add_pid(JobTable *jt, Job *job, unsigned int i, pid_t pid);
+int find_jid(JobTable *jt, pid_t pid);
+void job_signal(Job *job, int sig);
+void job_retire(JobTable *jt, Job *job);
+int job_kill(JobTable *jt, pid_t pid, int sig);
 
-void print_bg_job(Job *job, int jid);
+void print_bg_job(Job *job);
 void free_job(Job *job);
-void free_job_safe(Job **jobs, Job *job, int *job_ids);
+void free_job_safe(JobTable *jt, Job *job);
 void set_fg_pgrp(pid_t pgid);
 
 
-#endif /* _jobs_h_ */
\ No newline at end of file
+#endif /* _jobs_h_ */
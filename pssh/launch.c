@@ -0,0 +1,248 @@
+/* Process launch backends.
+ *
+ * A plain fork() of the shell has to duplicate the page tables of
+ * everything it has mapped (readline, history, the job table) only for
+ * the child to throw them away at exec.  posix_spawn() lets the C library
+ * use a vfork-style clone that shares the parent's memory until the exec,
+ * so its cost does not grow with the shell.  The pipe and redirect fds and
+ * the process group are described up front as spawn attributes instead of
+ * being set up by code running in the child.
+ *
+ * A child's LaunchAttrs are set in the child before it execs with fork()
+ * and the zygote.  posix_spawn() has no attribute for the CPU affinity,
+ * and glibc's POSIX_SPAWN_SETSCHEDULER only takes SCHED_OTHER, FIFO and
+ * RR, so the calling thread takes on the child's mask and policy for the
+ * spawn (the child inherits them) and goes back to its own afterwards.
+ *
+ * The third backend hands the launch to a small helper process instead
+ * (see zygote.c).
+ *
+ * All backends are kept so they can be compared; the mode is chosen at
+ * startup from $PSSH_LAUNCH or later with the 'launch' builtin. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "launch.h"
+#include "zygote.h"
+
+/* glibc only defines it for _GNU_SOURCE */
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+
+LaunchMode launch_mode = LAUNCH_SPAWN;
+
+static const char *mode_names[] = {
+    "fork",
+    "spawn",
+    "zygote",
+    NULL};
+
+/* returns -1 if there is no such mode and -2 if it could not be started */
+int launch_set_mode(const char *name)
+{
+    int i;
+
+    for (i = 0; mode_names[i]; i++)
+    {
+        if (!strcmp(name, mode_names[i]))
+        {
+            if (i == LAUNCH_ZYGOTE && zygote_start() == -1)
+            {
+                fprintf(stderr, "pssh: cannot start the launch zygote\n");
+                return -2;
+            }
+            launch_mode = (LaunchMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *launch_mode_name(LaunchMode mode)
+{
+    return mode_names[mode];
+}
+
+/* the shell blocks SIGCHLD (it is read through a signalfd) and ignores the
+ * terminal job control signals.  Both a blocked mask and SIG_IGN survive
+ * exec, so children have to be put back to the defaults. */
+static const int shell_signals[] = {SIGCHLD, SIGTTIN, SIGTTOU, 0};
+
+void launch_reset_signals(void)
+{
+    sigset_t none;
+    int i;
+
+    for (i = 0; shell_signals[i]; i++)
+        signal(shell_signals[i], SIG_DFL);
+
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+/* puts the calling process, a new child, in attrs (NULL for none) */
+void launch_apply(const LaunchAttrs *attrs)
+{
+    struct sched_param sp;
+
+    if (!attrs)
+        return;
+
+    if (attrs->cpus)
+        place_set(0, attrs->cpus);
+    if (attrs->batch)
+    {
+        memset(&sp, 0, sizeof(sp));
+        sched_setscheduler(0, SCHED_BATCH, &sp);
+    }
+}
+
+static pid_t launch_fork(const char *path, char **argv, char **envp, int in,
+                         int out, int err, int close_fd, pid_t pgid, int foreground,
+                         const LaunchAttrs *attrs)
+{
+    pid_t pid = fork();
+
+    if (pid)
+        return pid;
+
+    if (pgid >= 0)
+        setpgid(0, pgid);
+    if (foreground)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    launch_reset_signals();
+    launch_apply(attrs);
+    if (close_fd >= 0)
+        close(close_fd);
+    if (in != STDIN_FILENO)
+    {
+        dup2(in, STDIN_FILENO);
+        close(in);
+    }
+    if (out != STDOUT_FILENO)
+    {
+        dup2(out, STDOUT_FILENO);
+        if (out != err)
+            close(out);
+    }
+    if (err != STDERR_FILENO)
+    {
+        dup2(err, STDERR_FILENO);
+        close(err);
+    }
+
+    execve(path, argv, envp);
+    _exit(127);
+}
+
+static pid_t launch_spawn(const char *path, char **argv, char **envp,
+                          int in, int out, int err, int close_fd, pid_t pgid,
+                          const LaunchAttrs *attrs)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    struct sched_param sp, own_sp;
+    sigset_t none, defaults;
+    CpuMask own;
+    pid_t pid;
+    int rc, i, pinned = 0, batched = 0, policy = 0;
+
+    posix_spawn_file_actions_init(&fa);
+    if (close_fd >= 0)
+        posix_spawn_file_actions_addclose(&fa, close_fd);
+    if (in != STDIN_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&fa, in, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&fa, in);
+    }
+    if (out != STDOUT_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&fa, out, STDOUT_FILENO);
+        if (out != err)
+            posix_spawn_file_actions_addclose(&fa, out);
+    }
+    if (err != STDERR_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&fa, err, STDERR_FILENO);
+        posix_spawn_file_actions_addclose(&fa, err);
+    }
+
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    for (i = 0; shell_signals[i]; i++)
+        sigaddset(&defaults, shell_signals[i]);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, (pgid >= 0 ? POSIX_SPAWN_SETPGROUP : 0) |
+                                    POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+    if (pgid >= 0)
+        posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    if (attrs && attrs->cpus && !place_get(0, &own))
+        pinned = !place_set(0, attrs->cpus);
+    if (attrs && attrs->batch && (policy = sched_getscheduler(0)) != SCHED_BATCH &&
+        !sched_getparam(0, &own_sp))
+    {
+        memset(&sp, 0, sizeof(sp));
+        batched = !sched_setscheduler(0, SCHED_BATCH, &sp);
+    }
+
+    rc = posix_spawn(&pid, path, &fa, &attr, argv, envp);
+
+    if (pinned)
+        place_set(0, &own);
+    if (batched)
+        sched_setscheduler(0, policy, &own_sp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+
+    if (rc)
+    {
+        fprintf(stderr, "pssh: %s: %s\n", path, strerror(rc));
+        return -1;
+    }
+    return pid;
+}
+
+/* starts path with argv and environment envp in process group pgid (0
+ * makes the new process the leader of its own group, -1 leaves it in the
+ * caller's group) with stdin/stdout/stderr connected to in/out/err.
+ * close_fd, if not -1, is closed in the child (the unused end of the
+ * pipe being built).  With foreground set the child puts its group in
+ * the foreground of the terminal on the shell's stdin before it execs,
+ * so it cannot read the terminal before the shell has handed it over;
+ * posix_spawn() has no way to, so the caller still has to.  attrs may
+ * be NULL.  Returns the child's pid or -1. */
+pid_t launch_exec(LaunchMode mode, const char *path, char **argv, char **envp,
+                  int in, int out, int err, int close_fd, pid_t pgid,
+                  int foreground, const LaunchAttrs *attrs)
+{
+    pid_t pid;
+
+    if (mode == LAUNCH_ZYGOTE)
+    {
+        /* the zygote never had close_fd, so the child does not either */
+        pid = zygote_launch(path, argv, envp, in, out, err, pgid, foreground, attrs);
+        if (pid != -1 || errno != EPIPE)
+            return pid;
+
+        fprintf(stderr, "pssh: the launch zygote has gone, using spawn\n");
+        launch_mode = mode = LAUNCH_SPAWN;
+    }
+
+    if (mode == LAUNCH_SPAWN)
+        return launch_spawn(path, argv, envp, in, out, err, close_fd, pgid, attrs);
+
+    return launch_fork(path, argv, envp, in, out, err, close_fd, pgid, foreground, attrs);
+}
@@ -0,0 +1,32 @@
+#ifndef _launch_h_
+#define _launch_h_
+
+#include <sys/types.h>
+#include "place.h"
+
+typedef enum
+{
+    LAUNCH_FORK,    /* fork() then execve() in the child */
+    LAUNCH_SPAWN,   /* posix_spawn() with file actions */
+    LAUNCH_ZYGOTE,  /* asks the zygote process to start it (zygote.c) */
+} LaunchMode;
+
+/* what a child starts with besides its fds and process group, so it
+ * is in place before its first instruction */
+typedef struct
+{
+    const CpuMask *cpus;    /* its CPU affinity, or NULL for the shell's */
+    int batch;              /* started with SCHED_BATCH (prio.c) */
+} LaunchAttrs;
+
+extern LaunchMode launch_mode;
+
+int launch_set_mode(const char *name);
+const char *launch_mode_name(LaunchMode mode);
+void launch_reset_signals(void);
+void launch_apply(const LaunchAttrs *attrs);
+pid_t launch_exec(LaunchMode mode, const char *path, char **argv, char **envp,
+                  int in, int out, int err, int close_fd, pid_t pgid,
+                  int foreground, const LaunchAttrs *attrs);
+
+#endif /* _launch_h_ */
@@ -0,0 +1,306 @@
+/* Single pass tokenizer for the shell's command line syntax.
+ *
+ * Splits a command line into words and the operators | < > & in one
+ * left to right scan.  Quoted strings ("..." or '...') may appear
+ * anywhere inside a word and are joined with the text around them, so
+ *
+ *     echo "a b"'c'd | wc
+ *
+ * produces WORD(echo) WORD(a bcd) PIPE WORD(wc).  Operators inside quotes
+ * are ordinary characters.  Word text is copied (without the quotes)
+ * into one buffer from the arena, so lexing is linear in the length of
+ * the line no matter how many words it has.
+ *
+ * A word with an unquoted * ? or [ is also a glob pattern.  The pattern
+ * is the word's text unless it has quoted wildcards or backslashes,
+ * which must match themselves: only then is the word scanned a second
+ * time to write a copy with those characters escaped by a backslash.
+ *
+ * Once lex_set_lookup() has been given a way to look variables up, $NAME,
+ * ${NAME}, $? and $$ outside single quotes are replaced by their values
+ * (an unset variable by nothing) as the word is copied.  The value is
+ * not split into words and its wildcards match themselves.  A word that
+ * starts a command (and the words after it that do) with an unquoted
+ * NAME= is marked as an assignment. */
+#include <ctype.h>
+#include <string.h>
+
+#include "lex.h"
+#include "arena.h"
+
+static const char* (*lex_lookup) (const char* name, size_t len);
+
+
+static void push (Arena* A, TokenList* L, unsigned int* cap, TokenType type, char* text,
+                  char* pattern, int assign)
+{
+    Token* toks;
+
+    if (L->ntoks == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        toks = arena_alloc (A, *cap * sizeof(*toks));
+        if (L->ntoks)
+            memcpy (toks, L->toks, L->ntoks * sizeof(*toks));
+        L->toks = toks;
+    }
+
+    L->toks[L->ntoks].type = type;
+    L->toks[L->ntoks].text = text;
+    L->toks[L->ntoks].pattern = pattern;
+    L->toks[L->ntoks].assign = assign;
+    L->ntoks++;
+}
+
+
+static int op_type (char c, TokenType* type)
+{
+    switch (c) {
+    case '|': *type = TOK_PIPE; return 1;
+    case '<': *type = TOK_IN;   return 1;
+    case '>': *type = TOK_OUT;  return 1;
+    case '&': *type = TOK_AMP;  return 1;
+    }
+
+    return 0;
+}
+
+
+static int is_wild (char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
+
+
+static int is_name (char c, int first)
+{
+    return isalpha ((unsigned char)c) || c == '_' || (!first && isdigit ((unsigned char)c));
+}
+
+
+/* the reference at s, which is a '$': sets *name and *len to the name
+ * and returns the end of the reference, or NULL if the '$' is literal */
+static const char* var_ref (const char* s, const char** name, size_t* len)
+{
+    const char* p = s + 1;
+    const char* q;
+
+    if (*p == '?' || *p == '$') {
+        *name = p;
+        *len = 1;
+        return p + 1;
+    }
+
+    if (*p == '{')
+        p++;
+    for (q = p; is_name (*q, q == p); q++)
+        ;
+    if (q == p || (p[-1] == '{' && *q != '}'))
+        return NULL;
+
+    *name = p;
+    *len = q - p;
+    return p[-1] == '{' ? q + 1 : q;
+}
+
+
+/* the value of the reference at s, or NULL with *s left alone if it is
+ * a literal '$'; *s is moved past the reference */
+static const char* expand (const char** s)
+{
+    const char *name, *end, *value;
+    size_t len;
+
+    if (!lex_lookup || !(end = var_ref (*s, &name, &len)))
+        return NULL;
+
+    value = lex_lookup (name, len);
+    *s = end;
+    return value ? value : "";
+}
+
+
+/* the glob pattern for the word whose source is [s, end) and whose text
+ * is len bytes long: quoted wildcards, wildcards from variables and all
+ * backslashes escaped, quotes removed */
+static char* escape_pattern (Arena* A, const char* s, const char* end, size_t len)
+{
+    char *pattern = arena_alloc (A, 2 * len + 1), *out = pattern;
+    const char* value;
+    char quote = 0;
+
+    while (s < end) {
+        if (!quote && (*s == '\"' || *s == '\'')) {
+            quote = *s++;
+            continue;
+        }
+        if (*s == quote) {
+            quote = 0;
+            s++;
+            continue;
+        }
+
+        if (*s == '$' && quote != '\'' && (value = expand (&s))) {
+            for (; *value; value++) {
+                if (is_wild (*value))
+                    *out++ = '\\';
+                *out++ = *value;
+            }
+            continue;
+        }
+
+        if (*s == '\\' || (quote && is_wild (*s)))
+            *out++ = '\\';
+        *out++ = *s++;
+    }
+    *out = '\0';
+
+    return pattern;
+}
+
+
+/* 1 if the word with text word and source from src starts with NAME=
+ * in which nothing was quoted or expanded: the text and the source are
+ * then the same up to the '=' */
+static int is_assign (const char* word, const char* src)
+{
+    const char* p;
+
+    for (p = word; is_name (*p, p == word); p++)
+        if (*p != src[p - word])
+            return 0;
+
+    return p != word && *p == '=' && src[p - word] == '=';
+}
+
+
+/* 1 if the next word starts a command: assignments can only come there */
+static int at_command (TokenList* L)
+{
+    Token* last = L->ntoks ? &L->toks[L->ntoks - 1] : NULL;
+
+    return !last || last->type == TOK_PIPE || last->assign;
+}
+
+
+/* makes room for n more bytes of the word being built at *word, plus
+ * whatever the rest bytes of source after it can produce, moving it to a
+ * bigger buffer if a variable's value has used up the space */
+static char* reserve (Arena* A, char** word, char* out, char** limit, size_t n, size_t rest)
+{
+    size_t have = out - *word, size;
+
+    if ((size_t)(*limit - out) >= n + 2 * rest + 1)
+        return out;
+
+    size = 2 * (have + n) + 2 * rest + 1;
+    out = arena_alloc (A, size);
+    memcpy (out, *word, have);
+    *word = out;
+    *limit = out + size;
+
+    return out + have;
+}
+
+
+/* returns 0 on success or -1 if a quote is left unterminated */
+int lex_cmdline (Arena* A, const char* cmdline, TokenList* L)
+{
+    const char *s = cmdline, *src = cmdline, *end, *value;
+    char *out, *word, *limit, *pattern;
+    unsigned int cap = 0;
+    int in_word = 0, glob = 0, escape = 0, quoted = 0;
+    size_t len;
+    TokenType type;
+    char quote;
+
+    L->toks = NULL;
+    L->ntoks = 0;
+
+    /* every character is copied at most once, plus one NUL per word;
+     * only a variable's value can make a word outgrow that */
+    len = strlen (cmdline);
+    end = cmdline + len;
+    out = arena_alloc (A, 2 * len + 1);
+    word = out;
+    limit = out + 2 * len + 1;
+
+    for (;;) {
+        if (*s == '\"' || *s == '\'') {
+            if (!in_word)
+                src = s;
+            quote = *s++;
+            while (*s && *s != quote) {
+                if (*s == '$' && quote == '\"' && (value = expand (&s))) {
+                    out = reserve (A, &word, out, &limit, strlen (value), end - s);
+                    for (; *value; value++) {
+                        escape |= is_wild (*value);
+                        *out++ = *value;
+                    }
+                    continue;
+                }
+                escape |= is_wild (*s);
+                *out++ = *s++;
+            }
+            if (!*s)
+                return -1;
+            s++;
+            in_word = quoted = 1;
+            continue;
+        }
+
+        if (!*s || isspace ((unsigned char)*s) || op_type (*s, &type)) {
+            /* a word that was nothing but unset variables is no word */
+            if (in_word && (out != word || quoted)) {
+                *out++ = '\0';
+                pattern = !glob ? NULL : escape ? escape_pattern (A, src, s, out - word - 1) : word;
+                push (A, L, &cap, TOK_WORD, word, pattern, at_command (L) && is_assign (word, src));
+                word = out;
+            }
+            in_word = glob = escape = quoted = 0;
+
+            if (!*s)
+                break;
+
+            if (op_type (*s, &type))
+                push (A, L, &cap, type, NULL, NULL, 0);
+
+            s++;
+            continue;
+        }
+
+        if (!in_word)
+            src = s;
+        switch (*s) {
+        case '\\':
+            escape = 1;
+            break;
+        case '*': case '?': case '[':
+            glob = 1;
+            break;
+        case '$':
+            if ((value = expand (&s))) {
+                out = reserve (A, &word, out, &limit, strlen (value), end - s);
+                for (; *value; value++) {
+                    escape |= is_wild (*value);
+                    *out++ = *value;
+                }
+                in_word = 1;
+                continue;
+            }
+        }
+
+        *out++ = *s++;
+        in_word = 1;
+    }
+
+    return 0;
+}
+
+
+/* how $NAME is looked up: fn returns the value of the variable whose
+ * name is the len bytes at name, or NULL.  Until this is called '$' is
+ * an ordinary character. */
+void lex_set_lookup (const char* (*fn) (const char* name, size_t len))
+{
+    lex_lookup = fn;
+}
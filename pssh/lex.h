@@ -0,0 +1,31 @@
+#ifndef _lex_h_
+#define _lex_h_
+
+#include <stddef.h>
+#include "arena.h"
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,   /* | */
+    TOK_IN,     /* < */
+    TOK_OUT,    /* > */
+    TOK_AMP,    /* & */
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    int assign;         /* TOK_WORD starting a command with an unquoted NAME= */
+    char* text;         /* TOK_WORD only: the word with quotes removed */
+    char* pattern;      /* TOK_WORD with an unquoted * ? or [: the word as a
+                           glob pattern, quoted characters \-escaped; else NULL */
+} Token;
+
+typedef struct {
+    Token* toks;
+    unsigned int ntoks;
+} TokenList;
+
+int lex_cmdline (Arena* A, const char* cmdline, TokenList* L);
+void lex_set_lookup (const char* (*fn) (const char* name, size_t len));
+
+#endif /* _lex_h_ */
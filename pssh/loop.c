@@ -0,0 +1,96 @@
+/* A minimal epoll based event loop.
+ *
+ * Everything the shell waits on (the terminal, child state changes) is a
+ * file descriptor registered here together with a callback, and the main
+ * loop just sleeps in epoll_wait() until one of them becomes readable. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "loop.h"
+
+#define MAX_EVENTS 64
+
+typedef struct
+{
+    LoopCallback cb;
+    void *ctx;
+} Watcher;
+
+static int epfd = -1;
+static Watcher *watchers;   /* indexed by fd */
+static int nwatchers;
+
+void loop_init(void)
+{
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        perror("pssh: epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* calls cb(fd, ctx) whenever fd is readable */
+void loop_add(int fd, LoopCallback cb, void *ctx)
+{
+    struct epoll_event ev;
+    int n;
+
+    if (fd >= nwatchers)
+    {
+        n = nwatchers ? nwatchers : 16;
+        while (n <= fd)
+            n *= 2;
+        watchers = realloc(watchers, n * sizeof(*watchers));
+        memset(watchers + nwatchers, 0, (n - nwatchers) * sizeof(*watchers));
+        nwatchers = n;
+    }
+
+    watchers[fd].cb = cb;
+    watchers[fd].ctx = ctx;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        perror("pssh: epoll_ctl");
+}
+
+/* must be called before fd is closed.  Events for fd that are already
+ * pending in the current batch are dropped. */
+void loop_del(int fd)
+{
+    if (fd < 0 || fd >= nwatchers || !watchers[fd].cb)
+        return;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    watchers[fd].cb = NULL;
+    watchers[fd].ctx = NULL;
+}
+
+/* waits up to timeout_ms (-1 for ever) and dispatches every ready fd.
+ * Returns the number of events handled. */
+int loop_run_once(int timeout_ms)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    int i, n, fd;
+
+    n = epoll_wait(epfd, ev, MAX_EVENTS, timeout_ms);
+    if (n == -1)
+    {
+        if (errno != EINTR)
+            perror("pssh: epoll_wait");
+        return 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        fd = ev[i].data.fd;
+        if (fd < nwatchers && watchers[fd].cb)
+            watchers[fd].cb(fd, watchers[fd].ctx);
+    }
+
+    return n;
+}
@@ -0,0 +1,11 @@
+#ifndef _loop_h_
+#define _loop_h_
+
+typedef void (*LoopCallback)(int fd, void *ctx);
+
+void loop_init(void);
+void loop_add(int fd, LoopCallback cb, void *ctx);
+void loop_del(int fd);
+int loop_run_once(int timeout_ms);
+
+#endif /* _loop_h_ */
@@ -0,0 +1,314 @@
+/* Per-job resource monitor for 'jobs -v' and 'jobs -w'.
+ *
+ * Every process the monitor has been asked about keeps its /proc stat,
+ * statm, io and children files open between samples, so a sample is a
+ * pread() of each rather than an open(), read() and close() of four
+ * paths.  CPU% is worked out from the CPU time used since the process's
+ * previous sample (since it started, for its first), so each sample
+ * only costs the reads.  Processes that are not asked about again in a
+ * sample are dropped with their files.
+ *
+ * A job's totals are those of its whole process group: the stages plus
+ * whatever they have started that is still in the job's group, found by
+ * following the children files down from each stage.
+ *
+ * Kept files are limited to half the fd limit; past that, a process's
+ * files are opened for each sample and closed again. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "monitor.h"
+
+#define INITIAL_BUCKETS 256
+
+enum
+{
+    F_STAT,
+    F_STATM,
+    F_IO,
+    F_CHILDREN,
+    NFILES
+};
+
+static const char *file_names[NFILES] = {"stat", "statm", "io", "task/%d/children"};
+
+typedef struct proc
+{
+    pid_t pid;
+    int fds[NFILES];            /* -1 if not kept open */
+    unsigned long long ticks;   /* utime + stime at the last sample */
+    double when;                /* CLOCK_BOOTTIME seconds of the last sample */
+    unsigned int generation;    /* of the sample it was last read in */
+    ProcSample s;
+    struct proc *next;
+} Proc;
+
+static Proc **buckets;
+static unsigned int nbuckets, nprocs;
+static unsigned int generation;
+static double now;
+
+static long ticks_per_sec;
+static long page_size;
+static unsigned int open_fds, max_fds;
+
+static void monitor_init(void)
+{
+    struct rlimit rl;
+
+    ticks_per_sec = sysconf(_SC_CLK_TCK);
+    page_size = sysconf(_SC_PAGESIZE);
+    max_fds = !getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur / 2 : 512;
+    nbuckets = INITIAL_BUCKETS;
+    buckets = calloc(nbuckets, sizeof(*buckets));
+}
+
+static void close_files(Proc *p)
+{
+    int i;
+
+    for (i = 0; i < NFILES; i++)
+    {
+        if (p->fds[i] != -1)
+        {
+            close(p->fds[i]);
+            open_fds--;
+        }
+    }
+}
+
+static void grow_buckets(void)
+{
+    unsigned int n = nbuckets * 2, i, h;
+    Proc **nb = calloc(n, sizeof(*nb));
+    Proc *p, *next;
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (p = buckets[i]; p; p = next)
+        {
+            next = p->next;
+            h = (unsigned int)p->pid & (n - 1);
+            p->next = nb[h];
+            nb[h] = p;
+        }
+    }
+
+    free(buckets);
+    buckets = nb;
+    nbuckets = n;
+}
+
+static Proc *find(pid_t pid, int create)
+{
+    Proc *p;
+    int i;
+
+    for (p = buckets[(unsigned int)pid & (nbuckets - 1)]; p; p = p->next)
+        if (p->pid == pid)
+            return p;
+
+    if (!create)
+        return NULL;
+
+    if (nprocs + 1 > nbuckets - nbuckets / 4)
+        grow_buckets();
+
+    p = calloc(1, sizeof(*p));
+    p->pid = pid;
+    for (i = 0; i < NFILES; i++)
+        p->fds[i] = -1;
+    p->next = buckets[(unsigned int)pid & (nbuckets - 1)];
+    buckets[(unsigned int)pid & (nbuckets - 1)] = p;
+    nprocs++;
+
+    return p;
+}
+
+/* reads file f of p into buf (NUL terminated); -1 once the process is gone */
+static ssize_t read_file(Proc *p, int f, char *buf, size_t len)
+{
+    char path[64], name[32];
+    ssize_t n;
+    int fd = p->fds[f];
+
+    if (fd == -1)
+    {
+        snprintf(name, sizeof(name), file_names[f], p->pid);
+        snprintf(path, sizeof(path), "/proc/%d/%s", p->pid, name);
+        if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+            return -1;
+        if (open_fds < max_fds)
+        {
+            p->fds[f] = fd;
+            open_fds++;
+        }
+    }
+
+    n = pread(fd, buf, len - 1, 0);
+    if (p->fds[f] != fd)
+        close(fd);
+    if (n < 0)
+        return -1;
+
+    buf[n] = '\0';
+    return n;
+}
+
+static unsigned long long io_field(const char *buf, const char *name)
+{
+    const char *s = strstr(buf, name);
+
+    return s ? strtoull(s + strlen(name), NULL, 10) : 0;
+}
+
+static double boot_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* reads p's files into p->s; returns -1 if the process is gone */
+static int sample(Proc *p)
+{
+    unsigned long long utime, stime, start, ticks;
+    unsigned long size, resident;
+    char buf[1024], *s;
+    double since;
+    int pgrp;
+
+    if (read_file(p, F_STAT, buf, sizeof(buf)) == -1 || !(s = strrchr(buf, ')')))
+        return -1;
+
+    /* the fields after the command name, from the third (state) on */
+    if (sscanf(s + 2, "%c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+               &p->s.state, &pgrp, &utime, &stime, &start) != 5)
+        return -1;
+    p->s.pgrp = pgrp;
+
+    /* the first time, the average since the process started */
+    ticks = utime + stime;
+    if (p->generation)
+        since = now - p->when;
+    else
+    {
+        since = now - (double)start / ticks_per_sec;
+        p->ticks = 0;
+    }
+    p->s.cpu = since > 0 ? 100.0 * (ticks - p->ticks) / ticks_per_sec / since : 0;
+    p->ticks = ticks;
+    p->when = now;
+
+    if (read_file(p, F_STATM, buf, sizeof(buf)) != -1 && sscanf(buf, "%lu %lu", &size, &resident) == 2)
+        p->s.rss = (unsigned long long)resident * page_size;
+
+    /* all reads and writes, pipes and terminals included */
+    if (read_file(p, F_IO, buf, sizeof(buf)) != -1)
+    {
+        p->s.read = io_field(buf, "rchar:");
+        p->s.write = io_field(buf, "wchar:");
+    }
+
+    p->generation = generation;
+    return 0;
+}
+
+/* starts a sample: processes not looked up again before monitor_end()
+ * are forgotten */
+void monitor_begin(void)
+{
+    if (!buckets)
+        monitor_init();
+
+    generation++;
+    now = boot_seconds();
+}
+
+/* the current figures for pid, or NULL if it has gone */
+const ProcSample *monitor_proc(pid_t pid)
+{
+    Proc *p = find(pid, 1);
+
+    if (p->generation == generation)
+        return &p->s;
+
+    if (sample(p) == -1)
+    {
+        /* a pid that is reused later must not be read through old fds */
+        close_files(p);
+        p->generation = 0;
+        return NULL;
+    }
+
+    return &p->s;
+}
+
+static void add_group(pid_t pid, pid_t pgid, ProcSample *total, int depth)
+{
+    const ProcSample *s = monitor_proc(pid);
+    char buf[4096], *c, *end;
+    Proc *p;
+
+    if (!s || (pgid > 0 && s->pgrp != pgid))
+        return;
+
+    total->cpu += s->cpu;
+    total->rss += s->rss;
+    total->read += s->read;
+    total->write += s->write;
+
+    p = find(pid, 0);
+    if (depth > 64 || read_file(p, F_CHILDREN, buf, sizeof(buf)) <= 0)
+        return;
+
+    for (c = buf; *c; c = end)
+    {
+        pid = strtol(c, &end, 10);
+        if (end == c)
+            break;
+        add_group(pid, pgid, total, depth + 1);
+    }
+}
+
+/* adds up job's process group: each stage and whatever it has started
+ * that is still in the group */
+void monitor_job(Job *job, ProcSample *total)
+{
+    unsigned int t;
+
+    memset(total, 0, sizeof(*total));
+    for (t = 0; t < job->npids; t++)
+        if (job->pids[t] > 0)
+            add_group(job->pids[t], job->pgid, total, 0);
+}
+
+/* forgets the processes that were not part of this sample */
+void monitor_end(void)
+{
+    unsigned int i;
+    Proc **pp, *p;
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (pp = &buckets[i]; (p = *pp);)
+        {
+            if (p->generation == generation)
+            {
+                pp = &p->next;
+                continue;
+            }
+            *pp = p->next;
+            close_files(p);
+            free(p);
+            nprocs--;
+        }
+    }
+}
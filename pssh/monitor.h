@@ -0,0 +1,23 @@
+#ifndef _monitor_h_
+#define _monitor_h_
+
+#include <sys/types.h>
+#include "jobs.h"
+
+/* one process, or the totals of a job's process group */
+typedef struct
+{
+    char state;                 /* as in /proc/<pid>/stat: R, S, D, T, Z, ... */
+    pid_t pgrp;
+    double cpu;                 /* % of one CPU since the last sample */
+    unsigned long long rss;     /* bytes */
+    unsigned long long read;    /* bytes read and written so far */
+    unsigned long long write;
+} ProcSample;
+
+void monitor_begin(void);
+const ProcSample *monitor_proc(pid_t pid);
+void monitor_job(Job *job, ProcSample *total);
+void monitor_end(void);
+
+#endif /* _monitor_h_ */
@@ -0,0 +1,633 @@
+/* Bounded-concurrency fan-out: runs one command per item with at most
+ * max_jobs children in flight.
+ *
+ * Every item is an ordinary single-process Job in the shell's job table,
+ * so its exit arrives through the same pidfd/SIGCHLD path as any other
+ * job; the Job's done hook starts the next item as soon as a slot frees
+ * up.  A foreground run drives the event loop itself until every item is
+ * done; a background one returns at once and finishes from the loop.
+ *
+ * With keep_order each item writes to its own temporary file, which is
+ * copied out once every item before it has been printed.  With prefix
+ * the item's stdout and stderr share a pipe read through the loop, and
+ * each line is printed as it completes, tagged with the item (the host
+ * name, for 'on').  With aggregate the pipe is captured instead and every
+ * distinct output is printed once at the end (see aggregate.c); finished
+ * members then stay in the job table, with their group, until the run
+ * is over. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include "parallel.h"
+#include "aggregate.h"
+#include "launch.h"
+#include "path.h"
+#include "env.h"
+#include "loop.h"
+
+typedef struct Run Run;
+
+typedef struct
+{
+    Run *run;
+    Job *job;       /* NULL once the process has been reaped */
+    Job *member;    /* aggregate: the finished job, kept for 'jobs' */
+    int outfd;      /* keep_order: the item's output file, else -1 */
+    int pipefd;     /* prefix/aggregate: read end of the item's output */
+    int timerfd;    /* timeout_ms: fires when the item overstays, else -1 */
+    char *line;     /* prefix: the incomplete last line read so far */
+    size_t len, cap;
+    Capture out;    /* aggregate: everything read so far */
+    struct timespec start;
+    int status;
+    int timed_out;
+    int exited;
+    int finished;
+} Item;
+
+struct Run
+{
+    ParallelSpec *spec;
+    JobTable *jobs;
+    char *path;
+    Item *items;
+    unsigned int next;      /* next item to start */
+    unsigned int running;   /* started but not finished */
+    unsigned int finished;
+    unsigned int failed;
+    unsigned int flushed;   /* keep_order: items before this are printed */
+    int devnull;
+    int interrupted;
+    Aggregate agg;
+    struct timespec start;
+    int sfd;                /* foreground: SIGINT signalfd, else -1 */
+    sigset_t saved;         /* foreground: signal mask to restore */
+    int complete;
+    int result;             /* failed plus never started, once complete */
+};
+
+unsigned int parallel_default_jobs(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+static char **copy_strv(char **v, unsigned int n)
+{
+    char **copy = malloc((n + 1) * sizeof(*copy));
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        copy[i] = strdup(v[i]);
+    copy[n] = NULL;
+
+    return copy;
+}
+
+static void free_strv(char **v)
+{
+    unsigned int i;
+
+    for (i = 0; v[i]; i++)
+        free(v[i]);
+    free(v);
+}
+
+/* a spec owning copies of argv and items, so it can outlive the command
+ * line that asked for it.  Everything else is left at its default. */
+ParallelSpec *parallel_spec_new(char **argv, char **items, unsigned int nitems)
+{
+    ParallelSpec *spec = calloc(1, sizeof(*spec));
+    unsigned int argc;
+
+    for (argc = 0; argv[argc]; argc++)
+        ;
+
+    spec->argv = copy_strv(argv, argc);
+    spec->placeholder = "{}";
+    spec->items = copy_strv(items, nitems);
+    spec->nitems = nitems;
+    spec->out = STDOUT_FILENO;
+    spec->results = calloc(nitems + 1, sizeof(*spec->results));
+
+    return spec;
+}
+
+/* also closes spec->out unless it is stdout */
+void parallel_spec_free(ParallelSpec *spec)
+{
+    free_strv(spec->argv);
+    free_strv(spec->items);
+    free(spec->results);
+    if (spec->out != STDOUT_FILENO)
+        close(spec->out);
+    free(spec);
+}
+
+/* arg with every occurrence of key replaced by item; the result is
+ * malloc()ed */
+char *parallel_subst(const char *arg, const char *key, const char *item)
+{
+    size_t klen = strlen(key), ilen = strlen(item), len = strlen(arg) + 1;
+    const char *s, *hit;
+    char *out, *d;
+
+    for (s = arg; (hit = strstr(s, key)); s = hit + klen)
+        len += ilen - klen;
+
+    d = out = malloc(len);
+    for (s = arg; (hit = strstr(s, key)); s = hit + klen)
+    {
+        memcpy(d, s, hit - s);
+        d += hit - s;
+        memcpy(d, item, ilen);
+        d += ilen;
+    }
+    strcpy(d, s);
+
+    return out;
+}
+
+/* the argv for item: the template with the placeholder substituted, or
+ * with the item appended if the template does not mention it at all */
+static char **item_argv(char **tmpl, const char *key, const char *item)
+{
+    unsigned int i, n;
+    int subst = 0;
+    char **argv;
+
+    for (n = 0; tmpl[n]; n++)
+        if (strstr(tmpl[n], key))
+            subst = 1;
+
+    argv = malloc((n + 2) * sizeof(*argv));
+    for (i = 0; i < n; i++)
+        argv[i] = parallel_subst(tmpl[i], key, item);
+    if (!subst)
+        argv[i++] = strdup(item);
+    argv[i] = NULL;
+
+    return argv;
+}
+
+/* argv joined with single spaces; the result is malloc()ed */
+char *parallel_join(char **argv)
+{
+    size_t len = 1;
+    unsigned int i;
+    char *name, *d;
+
+    for (i = 0; argv[i]; i++)
+        len += strlen(argv[i]) + 1;
+
+    d = name = malloc(len);
+    *d = '\0';
+    for (i = 0; argv[i]; i++)
+    {
+        if (i)
+            *d++ = ' ';
+        d = stpcpy(d, argv[i]);
+    }
+
+    return name;
+}
+
+static void copy_fd(int from, int to)
+{
+    char buf[65536];
+    ssize_t n;
+
+    lseek(from, 0, SEEK_SET);
+    while ((n = read(from, buf, sizeof(buf))) > 0)
+        if (write(to, buf, n) != n)
+            break;
+}
+
+/* prints the finished items at the head of the queue, in order */
+static void flush_ordered(Run *run)
+{
+    Item *item;
+
+    while (run->flushed < run->next && run->items[run->flushed].finished)
+    {
+        item = &run->items[run->flushed++];
+        if (item->outfd != -1)
+        {
+            copy_fd(item->outfd, run->spec->out);
+            close(item->outfd);
+            item->outfd = -1;
+        }
+    }
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void stop_interrupts(Run *run)
+{
+    if (run->sfd == -1)
+        return;
+
+    loop_del(run->sfd);
+    close(run->sfd);
+    run->sfd = -1;
+    sigprocmask(SIG_SETMASK, &run->saved, NULL);
+}
+
+/* every item has been started (or the run was interrupted) and all of
+ * them have finished: print what was held back and hand over to done().
+ * A background run is freed here, a foreground one by parallel_run(). */
+static void run_complete(Run *run)
+{
+    ParallelSpec *spec = run->spec;
+    int background = spec->background;
+    unsigned int i;
+
+    spec->secs = elapsed(&run->start);
+    spec->interrupted = run->interrupted;
+    stop_interrupts(run);
+
+    if (spec->aggregate)
+    {
+        aggregate_print(&run->agg, spec->items, spec->out);
+        aggregate_free(&run->agg);
+    }
+
+    for (i = 0; i < run->next; i++)
+        if (run->items[i].member)
+            free_job_safe(run->jobs, run->items[i].member);
+
+    run->result = run->failed + (spec->nitems - run->finished);
+    run->complete = 1;
+
+    close(run->devnull);
+    free(run->items);
+    free(run->path);
+    run->items = NULL;
+
+    if (spec->done)
+        spec->done(spec, run->result);
+    if (background)
+        free(run);
+}
+
+static void start_items(Run *run);
+
+/* an item is finished once its process has been reaped and, when its
+ * output is captured, the pipe has been drained */
+static void item_finish(Item *item)
+{
+    Run *run = item->run;
+    ParallelResult *res;
+
+    if (!item->exited || item->pipefd != -1 || item->finished)
+        return;
+
+    if (item->timerfd != -1)
+    {
+        loop_del(item->timerfd);
+        close(item->timerfd);
+        item->timerfd = -1;
+    }
+
+    item->finished = 1;
+    run->running--;
+    run->finished++;
+    if (item->status || item->timed_out)
+        run->failed++;
+
+    res = &run->spec->results[item - run->items];
+    res->status = item->status;
+    res->timed_out = item->timed_out;
+    res->finished = 1;
+    res->secs = elapsed(&item->start);
+
+    flush_ordered(run);
+    start_items(run);
+
+    if (!run->running)
+        run_complete(run);
+}
+
+static void write_line(Item *item, const char *line, size_t len)
+{
+    const char *label = item->run->spec->items[item - item->run->items];
+    struct iovec iov[3] = {
+        {(void *)label, strlen(label)},
+        {": ", 2},
+        {(void *)line, len}};
+
+    writev(item->run->spec->out, iov, 3);
+}
+
+static void close_output(Item *item)
+{
+    Run *run = item->run;
+    Job *job = item->job ? item->job : item->member;
+    int group;
+
+    if (run->spec->aggregate)
+    {
+        group = aggregate_add(&run->agg, &item->out, item - run->items);
+        if (job)
+            job->group = group;
+    }
+    else if (item->len)
+    {
+        item->line[item->len++] = '\n';
+        write_line(item, item->line, item->len);
+    }
+    free(item->line);
+    item->line = NULL;
+    item->len = item->cap = 0;
+
+    loop_del(item->pipefd);
+    close(item->pipefd);
+    item->pipefd = -1;
+}
+
+/* the item's process has been reaped.  In aggregate mode its Job is kept
+ * (see job_retire()) so 'jobs' can show the group it landed in. */
+static int item_done(void *ctx, int status)
+{
+    Item *item = ctx;
+    int keep = item->run->spec->aggregate;
+
+    if (keep)
+    {
+        item->member = item->job;
+        job_retire(item->run->jobs, item->member);
+    }
+
+    item->job = NULL;
+    item->exited = 1;
+    item->status = status;
+
+    /* whatever it left behind in its process group is already dead */
+    if (item->timed_out && item->pipefd != -1)
+        close_output(item);
+
+    item_finish(item);
+    return keep;
+}
+
+/* prefix mode: copies every complete line of the item's output, tagged
+ * with the item, and keeps the rest for the next read.  In aggregate
+ * mode everything goes into the item's capture instead. */
+static void item_readable(int fd, void *ctx)
+{
+    Item *item = ctx;
+    char *nl, *s;
+    ssize_t n;
+
+    if (item->cap - item->len < 4096 + 1)
+    {
+        item->cap = item->cap ? item->cap * 2 : 8192;
+        item->line = realloc(item->line, item->cap);
+    }
+
+    /* one byte stays free for the newline close_output() may add */
+    if ((n = read(fd, item->line + item->len, item->cap - item->len - 1)) <= 0)
+    {
+        close_output(item);
+        item_finish(item);
+        return;
+    }
+
+    if (item->run->spec->aggregate)
+    {
+        capture_append(&item->out, item->line, n);
+        return;
+    }
+    item->len += n;
+
+    for (s = item->line; (nl = memchr(s, '\n', item->line + item->len - s)); s = nl + 1)
+        write_line(item, s, nl + 1 - s);
+
+    item->len -= s - item->line;
+    memmove(item->line, s, item->len);
+}
+
+static void timer_fired(int fd, void *ctx)
+{
+    Item *item = ctx;
+    uint64_t ticks;
+
+    read(fd, &ticks, sizeof(ticks));
+    item->timed_out = 1;
+
+    if (item->job)
+        kill(-item->job->pgid, SIGKILL);
+    else if (item->pipefd != -1)
+    {
+        /* something the item left behind still holds the pipe open */
+        close_output(item);
+        item_finish(item);
+    }
+}
+
+static void start_timer(Item *item, int ms)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+
+    if ((item->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+        return;
+
+    timerfd_settime(item->timerfd, 0, &its, NULL);
+    loop_add(item->timerfd, timer_fired, item);
+}
+
+static void start_item(Run *run, Item *item, const char *arg)
+{
+    ParallelSpec *spec = run->spec;
+    char **argv = item_argv(spec->argv, spec->placeholder, arg);
+    char *name = parallel_join(argv);
+    Parse P = {.ntasks = 1, .background = 1};
+    int out = spec->out, err = STDERR_FILENO;
+    int fd[2];
+    Job *job;
+    pid_t pid;
+
+    item->run = run;
+    clock_gettime(CLOCK_MONOTONIC, &item->start);
+
+    if (spec->keep_order && !spec->prefix && !spec->aggregate &&
+        (item->outfd = capture_tmpfile()) != -1)
+        out = item->outfd;
+
+    if ((spec->prefix || spec->aggregate) && pipe(fd) == 0)
+    {
+        fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+        item->pipefd = fd[0];
+        out = err = fd[1];
+        capture_init(&item->out);
+    }
+
+    job = new_job(name, &P);
+    job->done = item_done;
+    job->done_ctx = item;
+    job_insert(run->jobs, job);
+
+    /* each item gets a process group of its own, so a signal meant for
+     * the whole run has to come through the shell (see interrupt()) */
+    pid = launch_exec(launch_mode, run->path, argv, env_vector(), run->devnull,
+                      out, err, -1, 0, 0, NULL);
+
+    free_strv(argv);
+    free(name);
+    if (item->pipefd != -1)
+        close(fd[1]);
+
+    run->running++;
+
+    if (pid == -1)
+    {
+        free_job_safe(run->jobs, job);
+        if (item->pipefd != -1)
+        {
+            close(item->pipefd);
+            item->pipefd = -1;
+        }
+        spec->results[item - run->items].status = 127;
+        spec->results[item - run->items].finished = 1;
+
+        /* finished by hand: item_finish() would recurse into us */
+        item->exited = item->finished = 1;
+        run->running--;
+        run->finished++;
+        run->failed++;
+        return;
+    }
+
+    job_add_pid(run->jobs, job, 0, pid);
+    job->pgid = pid;
+    item->job = job;
+
+    if (item->pipefd != -1)
+        loop_add(item->pipefd, item_readable, item);
+    if (spec->timeout_ms > 0)
+        start_timer(item, spec->timeout_ms);
+}
+
+static void start_items(Run *run)
+{
+    Item *item;
+
+    while (!run->interrupted && run->next < run->spec->nitems &&
+           run->running < run->spec->max_jobs)
+    {
+        item = &run->items[run->next];
+        start_item(run, item, run->spec->items[run->next++]);
+    }
+
+    flush_ordered(run);
+}
+
+/* SIGINT is blocked while a foreground run is in progress and read from
+ * a signalfd: stop starting items and pass it on to the running ones, as
+ * the terminal would have done for a foreground job */
+static void interrupt(int sfd, void *ctx)
+{
+    struct signalfd_siginfo ssi;
+    Run *run = ctx;
+    unsigned int i;
+
+    while (read(sfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+        ;
+
+    run->interrupted = 1;
+    for (i = run->flushed; i < run->next; i++)
+        if (run->items[i].job)
+            kill(-run->items[i].job->pgid, SIGINT);
+}
+
+static void catch_interrupts(Run *run)
+{
+    sigset_t intr;
+
+    sigemptyset(&intr);
+    sigaddset(&intr, SIGINT);
+    sigprocmask(SIG_BLOCK, &intr, &run->saved);
+
+    if ((run->sfd = signalfd(-1, &intr, SFD_NONBLOCK | SFD_CLOEXEC)) != -1)
+        loop_add(run->sfd, interrupt, run);
+    else
+        sigprocmask(SIG_SETMASK, &run->saved, NULL);
+}
+
+/* Runs spec.  A foreground run returns once every item is done, with the
+ * number of items that failed (exited non-zero, were killed, could not be
+ * started or were never started because of an interrupt).  A background
+ * run returns 0 at once.  Either way spec->done, if set, is called with
+ * the same count at the end; it may free spec. */
+int parallel_run(ParallelSpec *spec, JobTable *jobs)
+{
+    int background = spec->background;
+    const char *path;
+    unsigned int i;
+    int result;
+    Run *run;
+
+    if (!(path = path_lookup(spec->argv[0])))
+    {
+        fprintf(stderr, "pssh: command not found: %s\n", spec->argv[0]);
+        result = spec->nitems;
+        if (spec->done)
+            spec->done(spec, result);
+        return background ? 0 : result;
+    }
+
+    if (!spec->max_jobs)
+        spec->max_jobs = parallel_default_jobs();
+
+    run = calloc(1, sizeof(*run));
+    run->spec = spec;
+    run->jobs = jobs;
+    run->path = strdup(path);
+    run->sfd = -1;
+
+    run->items = calloc(spec->nitems ? spec->nitems : 1, sizeof(*run->items));
+    for (i = 0; i < spec->nitems; i++)
+        run->items[i].outfd = run->items[i].pipefd = run->items[i].timerfd = -1;
+    run->devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if (!background)
+        catch_interrupts(run);
+
+    clock_gettime(CLOCK_MONOTONIC, &run->start);
+
+    start_items(run);
+    if (!run->running)
+        run_complete(run);
+
+    if (background)
+        return 0;
+
+    while (!run->complete)
+        loop_run_once(-1);
+
+    result = run->result;
+    free(run);
+
+    return result;
+}
@@ -0,0 +1,43 @@
+#ifndef _parallel_h_
+#define _parallel_h_
+
+#include "jobs.h"
+
+typedef struct
+{
+    int status;             /* exit status, 128+n if killed by signal n */
+    int timed_out;
+    double secs;            /* from launch until the item finished */
+    int finished;           /* 0 if the run was interrupted before it */
+} ParallelResult;
+
+typedef struct ParallelSpec ParallelSpec;
+
+struct ParallelSpec
+{
+    char **argv;            /* command template */
+    const char *placeholder; /* replaced by the item in argv, default {} */
+    char **items;
+    unsigned int nitems;
+    unsigned int max_jobs;  /* children in flight at once */
+    int keep_order;         /* print each item's output in input order */
+    int prefix;             /* capture stdout+stderr as "item: line" */
+    int aggregate;          /* capture stdout+stderr, print each distinct
+                             * output once at the end */
+    int timeout_ms;         /* kill an item running longer, 0 for never */
+    int background;         /* parallel_run() returns without waiting */
+    int out;                /* where the items' output goes */
+    ParallelResult *results; /* one per item */
+    double secs;            /* set at the end: wall time */
+    int interrupted;        /* set at the end: stopped by SIGINT */
+    void (*done)(ParallelSpec *spec, int failed);  /* called at the end */
+};
+
+unsigned int parallel_default_jobs(void);
+ParallelSpec *parallel_spec_new(char **argv, char **items, unsigned int nitems);
+void parallel_spec_free(ParallelSpec *spec);
+char *parallel_subst(const char *arg, const char *key, const char *item);
+char *parallel_join(char **argv);
+int parallel_run(ParallelSpec *spec, JobTable *jobs);
+
+#endif /* _parallel_h_ */
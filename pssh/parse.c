@@ -6,9 +6,13 @@
  *
  * Parses the following syntax:
  *
- *  ~$ command_1 [< infile] [| command_n]* [> outfile] [&]
+ *  ~$ [NAME=value]* command_1 [< infile] [| [NAME=value]* command_n]* [> outfile] [&]
+ *  ~$ NAME=value [NAME=value]*
  *
- * and produces a correspondingly populated Parse structure on the heap
+ * and produces a correspondingly populated Parse structure in an arena
+ *
+ * The line is first split into a token stream by lex_cmdline() and the
+ * Parse is then built from the tokens, both in a single linear pass.
  *
  * Note:
  *  - Items in brackets [ ] are optional
@@ -22,412 +26,145 @@
  *     ~$ ls -lh | grep 8.*K | wc -l
  *     ~$ gvim &
  **********************************************************************/
-#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "parse.h"
+#include "arena.h"
+#include "lex.h"
 
 
-typedef struct {
-    char* cmd;
-    char** argv;
-    char* input_fn;
-    char* output_fn;
-} Unit;
-
-static char ops[] = {'>', '<', '|', '\0'};
-
-
-static void trim (char* s)
-{
-    size_t start, end;
-
-    if (!s)
-        return;
-
-    end = strlen (s);
-
-    for (start=0; isspace (s[start]); ++start);
-
-    if (s[start]) {
-        while (end > 0 && isspace(s[end-1]))
-            --end;
-
-        memmove(s, &s[start], end-start);
-    }
-    s[end-start] = '\0';
-}
-
-
-static int is_background (char* cmdline)
-{
-    size_t last;
-    int ret = 0;
-
-    trim (cmdline);
-    last = strlen (cmdline) - 1;
-
-    if ('&' == cmdline[last]) {
-        cmdline[last] = '\0';
-        ret = 1;
-    }
-
-    return ret;
-}
-
-
-static int is_empty (char* cmdline)
+static Parse* parse_new (Arena* A)
 {
-    trim (cmdline);
+    Parse* P = arena_alloc (A, sizeof(*P));
 
-    if (!cmdline || !strlen(cmdline))
-        return 1;
-
-    return 0;
-}
-
-
-static int is_op (char c)
-{
-    int i;
-
-    for (i=0; ops[i]; i++)
-        if (c == ops[i])
-            return 1;
-
-    return 0;
-}
-
-
-static int has_trailing (char needle, char* haystack)
-{
-    trim (haystack);
-
-    if (haystack[0] == needle ||
-        haystack[strlen(haystack)-1] == needle) {
-        return 1;
-    }
+    P->tasks = NULL;
+    P->ntasks = 0;
+    P->infile = NULL;
+    P->outfile = NULL;
+    P->background = 0;
+    P->invalid_syntax = 0;
 
-    return 0;
+    return P;
 }
 
 
-static unsigned int count_char (char needle, char* haystack)
+/* fills task i of P from the tokens in [t, end), which contain no pipes.
+ * Assignments ahead of the first other word are kept apart from argv; a
+ * line of nothing but assignments sets shell variables, so it has to be
+ * a task of its own.
+ * Returns 0 if the segment is not valid syntax. */
+static int parse_task (Arena* A, Parse* P, int i, Token* t, Token* end)
 {
-    unsigned int c = 0;
-
-    while (*haystack)
-        if (*haystack++ == needle)
-            c++;
+    unsigned int argc = 0, nglobs = 0, nassigns = 0;
+    Token* tok;
+    Task* T = &P->tasks[i];
 
-    return c;
-}
-
-
-static unsigned int count_args (char* unit)
-{
-    unsigned int n = 0;
-
-    for (; *unit; unit++) {
-        if (isspace((unsigned char)(*unit))) {
-            while (isspace((unsigned char)(*++unit)));
-            if (*unit == '\"') {
-                do {
-                    unit++;
-                } while (*unit != '\"');
-                n++;
-            } else if (*unit == '\'') {
-                do {
-                    unit++;
-                } while (*unit != '\'');
-                n++;
-            } else if (!isspace((unsigned char)(*unit))) {
-                n++;
+    for (tok = t; tok < end; tok++) {
+        if (tok->type == TOK_WORD) {
+            if (tok->assign && !argc)
+                nassigns++;
+            else {
+                argc++;
+                nglobs += tok->pattern != NULL;
             }
+            continue;
         }
-    }
-
-    return n;
-}
-
-
-static int valid_syntax (Parse* P, Unit* U, int i)
-{
-    if (!U)
-        return 0;
 
-    if (U->input_fn && ((i != 0) || is_empty(U->input_fn)))
-        return 0;
-
-    if (U->output_fn && ((i != P->ntasks-1) || is_empty(U->output_fn)))
-        return 0;
+        /* a redirection consumes the word that follows it */
+        if (++tok == end || tok->type != TOK_WORD || !*tok->text)
+            return 0;
+
+        if (tok[-1].type == TOK_IN) {
+            if (i != 0 || P->infile)
+                return 0;
+            P->infile = tok->text;
+        } else {
+            if (i != P->ntasks-1 || P->outfile)
+                return 0;
+            P->outfile = tok->text;
+        }
+    }
 
-    if (!U->cmd || !*U->cmd)
+    if (!argc && (!nassigns || P->ntasks > 1))
         return 0;
 
-
-    return 1;
-}
-
-
-static char* parse_unary (char op, char* unit)
-{
-    char *start, *end, *arg;
-
-    for (start=NULL; *unit; unit++)
-        if (*unit == op) {
-           start = ++unit;
-           break;
+    T->argv = arena_alloc (A, (argc+1) * sizeof(*T->argv));
+    T->patterns = nglobs ? arena_alloc (A, (argc+1) * sizeof(*T->patterns)) : NULL;
+    T->assigns = nassigns ? arena_alloc (A, (nassigns+1) * sizeof(*T->assigns)) : NULL;
+    T->nassigns = nassigns;
+    for (argc = nassigns = 0, tok = t; tok < end; tok++) {
+        if (tok->type != TOK_WORD)
+            tok++;
+        else if (tok->assign && !argc)
+            T->assigns[nassigns++] = tok->text;
+        else {
+            if (T->patterns)
+                T->patterns[argc] = tok->pattern;
+            T->argv[argc++] = tok->text;
         }
-
-    if (!start)
-        return NULL;
-
-    for (end=start; *end; end++)
-        if (is_op(*end))
-           break;
-
-    arg = strndup (start, end - start);
-    arg[end - start] = '\0';
-    trim (arg);
-
-    start--;
-    memset (start, ' ', end - start);
-
-    return arg;
-}
-
-
-static char* argtok (char* str, char** state)
-{
-    char* ret;
-    char seek_ch;
-
-    if (!str)
-        str = *state;
-
-    if (!*str)
-        return NULL;
-
-    trim(str);
-
-    seek_ch = *str == '\"' ? '\"' :
-              *str == '\'' ? '\'' :
-              ' ';
-
-    ret = seek_ch == ' ' ? str : ++str;
-
-    str = strchr (str, seek_ch);
-
-    if (str)
-        *str = '\0';
-
-    *state = str ? ++str : (ret + strlen(ret));
-
-    return ret;
-}
-
-
-static void parse_command (Unit* U, char* unit)
-{
-    unsigned int argc, n;
-    char *str, *token, *state;
-
-    trim (unit);
-    argc = count_args (unit)+1; /* +1 for command */
-
-    U->argv = malloc ((argc+1) * sizeof(*U->argv));
-    U->argv[argc] = NULL;
-
-    for (n=0, str=unit; ; n++, str=NULL) {
-        token = argtok (str, &state);
-        if (!token)
-            break;
-
-        U->argv[n] = strdup (token);
     }
+    T->argv[argc] = NULL;
+    if (T->assigns)
+        T->assigns[nassigns] = NULL;
+    T->cmd = T->argv[0];
 
-    U->cmd = U->argv[0];
-}
-
-
-static Unit* parse_unit (char* unit)
-{
-    Unit* U;
-
-    int infiles = count_char ('<', unit);
-    int outfiles = count_char ('>', unit);
-
-    if (infiles > 1 || outfiles > 1)
-        return NULL;
-
-    if (count_char ('\'', unit) % 2)
-        return NULL;
-
-    if (count_char ('\"', unit) % 2)
-        return NULL;
-
-    U = malloc (sizeof(*U));
-    U->cmd = NULL;
-    U->argv = NULL;
-
-    if (infiles)
-        U->input_fn = parse_unary ('<', unit);
-    else
-        U->input_fn = NULL;
-
-    if (outfiles)
-        U->output_fn = parse_unary ('>', unit);
-    else
-        U->output_fn = NULL;
-
-    parse_command (U, unit);
+    if (T->cmd && !*T->cmd)
+        return 0;
 
-    return U;
+    return 1;
 }
 
 
-static void unit_destroy (Unit** U)
+/* everything in the returned Parse, including the Parse itself, is
+ * allocated from A and goes away with the next arena_reset() */
+Parse* parse_cmdline (Arena* A, const char* cmdline)
 {
+    TokenList L;
+    Token *t, *start, *end;
     int i;
+    Parse* P;
 
-    if (!*U)
-        return;
-
-    if ((*U)->input_fn)
-        free ((*U)->input_fn);
-
-    if ((*U)->output_fn)
-        free ((*U)->output_fn);
-
-    if ((*U)->argv) {
-        for (i=0; (*U)->argv[i]; i++)
-            free ((*U)->argv[i]);
-        free ((*U)->argv);
-    }
-
-    free (*U);
-    *U = NULL;
-}
-
-
-static void parse_add_unit (Parse* P, Unit* U, int i)
-{
-    if (!valid_syntax (P, U, i)) {
+    if (lex_cmdline (A, cmdline, &L) == -1) {
+        P = parse_new (A);
         P->invalid_syntax = 1;
-        goto out;
-    }
-
-    P->tasks[i].cmd = U->cmd;
-
-    if (U->argv) {
-        P->tasks[i].argv = U->argv;
-        U->argv = NULL;
+        return P;
     }
 
-    if (U->input_fn && (i == 0)) {
-        P->infile = U->input_fn;
-        U->input_fn = NULL;
-    }
-
-    if (U->output_fn && (i == P->ntasks-1)) {
-        P->outfile = U->output_fn;
-        U->output_fn = NULL;
-    }
-
-out:
-    unit_destroy (&U);
-}
-
-
-static Parse* parse_new ()
-{
-    Parse* P = malloc (sizeof(*P));
-
-    P->tasks = NULL;
-    P->ntasks = 0;
-    P->infile = NULL;
-    P->outfile = NULL;
-    P->background = 0;
-    P->invalid_syntax = 0;
-
-    return P;
-}
-
+    if (!L.ntoks)
+        return NULL;
 
-static void parse_init (Parse* P, char* cmdline)
-{
-    P->background = is_background (cmdline);
+    P = parse_new (A);
+    end = L.toks + L.ntoks;
 
-    if (count_char ('&', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
+    if (end[-1].type == TOK_AMP) {
+        P->background = 1;
+        end--;
     }
 
-    if (has_trailing ('|', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
+    P->ntasks = 1;
+    for (t = L.toks; t < end; t++) {
+        if (t->type == TOK_AMP) {
+            P->invalid_syntax = 1;
+            return P;
+        }
+        if (t->type == TOK_PIPE)
+            P->ntasks++;
     }
 
-    P->ntasks = count_char ('|', cmdline) + 1;
-    P->tasks = malloc (P->ntasks * sizeof (*P->tasks));
-    memset (P->tasks, 0, P->ntasks * sizeof (*P->tasks));
-}
+    P->tasks = arena_calloc (A, P->ntasks, sizeof (*P->tasks));
 
-
-void parse_destroy (Parse** P)
-{
-    int i, j;
-
-    if (!*P)
-        return;
-
-    if ((*P)->infile)
-        free ((*P)->infile);
-
-    if ((*P)->outfile)
-        free ((*P)->outfile);
-
-    if ((*P)->tasks) {
-        for (i=0; i<(*P)->ntasks; i++) {
-            if ((*P)->tasks[i].argv) {
-                for (j=0; (*P)->tasks[i].argv[j]; j++)
-                    free ((*P)->tasks[i].argv[j]);
-
-                free ((*P)->tasks[i].argv);
+    for (i = 0, start = t = L.toks; ; t++) {
+        if (t == end || t->type == TOK_PIPE) {
+            if (!parse_task (A, P, i++, start, t)) {
+                P->invalid_syntax = 1;
+                return P;
             }
+            if (t == end)
+                break;
+            start = t + 1;
         }
-        free ((*P)->tasks);
-    }
-
-    free (*P);
-    *P = NULL;
-}
-
-
-Parse* parse_cmdline (char* cmdline)
-{
-    char *str, *token, *state;
-    int i;
-    Unit* U;
-    Parse* P;
-
-    if (is_empty (cmdline))
-        return NULL;
-
-    P = parse_new ();
-    parse_init (P, cmdline);
-
-    for (i=0, str=cmdline; !P->invalid_syntax; i++, str=NULL) {
-        token = strtok_r (str, "|", &state);
-        if (!token)
-            break;
-
-        U = parse_unit (token);
-
-        parse_add_unit (P, U, i);
     }
 
     return P;
@@ -462,7 +199,11 @@ void parse_debug (Parse* P)
 
     for (i=0; i<P->ntasks; i++) {
         fprintf (stderr, "Task %i\n", i);
-        fprintf (stderr, "  - cmd: [%s]\n", P->tasks[i].cmd);
+        fprintf (stderr, "  - cmd: [%s]\n", P->tasks[i].cmd ? P->tasks[i].cmd : "");
+
+        if (P->tasks[i].assigns)
+            for (j=0; P->tasks[i].assigns[j]; j++)
+                fprintf (stderr, "    = assign[%i]: [%s]\n", j, P->tasks[i].assigns[j]);
 
         if (P->tasks[i].argv)
             for (j=0; P->tasks[i].argv[j]; j++)
@@ -2,10 +2,18 @@
 #define _parse_h_
 
 #include <limits.h>
+#include "arena.h"
 
 typedef struct {
-    char* cmd;
-    char** argv;   /* NULL terminated array of strings */
+    char* cmd;        /* NULL if the task is nothing but assignments */
+    char** argv;      /* NULL terminated array of strings */
+    char** patterns;  /* glob pattern of each argv entry (NULL if it has
+                         none), or NULL if no entry has one */
+    char** assigns;   /* NAME=value words before the command, NULL
+                         terminated, or NULL if there are none */
+    unsigned int nassigns;
+    char* path;       /* what cmd resolves to in PATH, set by the shell
+                         before it is run; NULL for builtins */
 } Task;
 
 typedef struct {
@@ -20,8 +28,7 @@ typedef struct {
 } Parse;
 
 
-Parse* parse_cmdline (char* cmdline);
-void parse_destroy (Parse** P);
+Parse* parse_cmdline (Arena* A, const char* cmdline);
 void parse_debug (Parse* P);
 int num_args(Task T);
 
@@ -0,0 +1,343 @@
+/* Command name -> absolute path resolver.
+ *
+ * Resolving a command used to mean walking every directory in PATH with
+ * access() each time a task was checked, and again inside execvp() in the
+ * child.  Here every successful resolution is remembered in a hash table
+ * keyed by the command name.  A cached entry stays valid as long as PATH
+ * itself is unchanged and neither the directory it was found in nor any
+ * directory before it in PATH has a new mtime (adding, removing or
+ * renaming a file in a directory bumps it), so a command installed
+ * earlier in PATH takes over at once.  The mtimes are only looked at
+ * again once the shell starts on a new command line (path_begin()): a
+ * directory is stat()ed at most once per line, however many stages
+ * and lookups the line has, and a hit after that costs nothing. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "path.h"
+#include "env.h"
+
+#define INITIAL_BUCKETS 64
+
+typedef struct entry
+{
+    char *name;
+    char *path;
+    unsigned int dir;   /* index into dirs[] the command was found in */
+    unsigned int hits;
+    struct entry *next;
+} Entry;
+
+typedef struct
+{
+    char *name;
+    struct timespec mtime;
+    int stamped;        /* mtime has been recorded */
+    unsigned int checked; /* epoch it was last stat()ed in */
+} Dir;
+
+static Entry **buckets;
+static unsigned int nbuckets;
+static unsigned int nentries;
+
+static Dir *dirs;
+static unsigned int ndirs;
+static char *path_env;  /* copy of the PATH the table was built for */
+static unsigned int epoch = 1; /* bumped for each command line */
+
+static unsigned int hash_str(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void free_entry(Entry *e)
+{
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+static void flush_entries(void)
+{
+    unsigned int i;
+    Entry *e, *next;
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (e = buckets[i]; e; e = next)
+        {
+            next = e->next;
+            free_entry(e);
+        }
+        buckets[i] = NULL;
+    }
+    nentries = 0;
+}
+
+static void free_dirs(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < ndirs; i++)
+        free(dirs[i].name);
+    free(dirs);
+    dirs = NULL;
+    ndirs = 0;
+}
+
+/* split PATH into dirs[]; empty components mean the current directory */
+static void load_dirs(const char *env)
+{
+    const char *s, *colon;
+    unsigned int n;
+
+    free_dirs();
+    free(path_env);
+    path_env = strdup(env);
+
+    for (n = 1, s = env; *s; s++)
+        if (*s == ':')
+            n++;
+
+    dirs = calloc(n, sizeof(*dirs));
+    for (s = env;; s = colon + 1)
+    {
+        colon = strchr(s, ':');
+        if (colon == s || !*s)
+            dirs[ndirs++].name = strdup(".");
+        else
+            dirs[ndirs++].name = colon ? strndup(s, colon - s) : strdup(s);
+
+        if (!colon)
+            break;
+    }
+}
+
+/* drop every cached command a change to dir d may have made stale: those
+ * found in it, or in a later directory it could now shadow */
+static void invalidate_from(unsigned int d)
+{
+    unsigned int i;
+    Entry **pe, *e;
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (pe = &buckets[i]; (e = *pe);)
+        {
+            if (e->dir >= d)
+            {
+                *pe = e->next;
+                free_entry(e);
+                nentries--;
+            }
+            else
+            {
+                pe = &e->next;
+            }
+        }
+    }
+}
+
+/* returns 1 if dir d is unchanged since it was last stamped.  A
+ * directory that does not exist stays unchanged until it is created.
+ * One that has already been looked at in this epoch counts as unchanged
+ * (a change then has already been dealt with). */
+static int dir_fresh(unsigned int d)
+{
+    struct timespec mtime = {-1, -1};
+    struct stat st;
+
+    if (dirs[d].stamped && dirs[d].checked == epoch)
+        return 1;
+    dirs[d].checked = epoch;
+
+    if (stat(dirs[d].name, &st) == 0)
+        mtime = st.st_mtim;
+
+    if (dirs[d].stamped &&
+        dirs[d].mtime.tv_sec == mtime.tv_sec &&
+        dirs[d].mtime.tv_nsec == mtime.tv_nsec)
+        return 1;
+
+    dirs[d].mtime = mtime;
+    dirs[d].stamped = 1;
+    return 0;
+}
+
+/* returns 1 if no dir up to and including last has changed since it was
+ * stamped.  All of them are stamped again, and the commands the first
+ * changed one may have made stale are dropped. */
+static int dirs_fresh(unsigned int last)
+{
+    unsigned int d;
+    int changed = -1;
+
+    for (d = 0; d <= last; d++)
+        if (!dir_fresh(d) && changed == -1)
+            changed = d;
+
+    if (changed == -1)
+        return 1;
+
+    invalidate_from(changed);
+    return 0;
+}
+
+static void grow_buckets(void)
+{
+    unsigned int i, n, h;
+    Entry **nb, *e, *next;
+
+    n = nbuckets ? nbuckets * 2 : INITIAL_BUCKETS;
+    nb = calloc(n, sizeof(*nb));
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (e = buckets[i]; e; e = next)
+        {
+            next = e->next;
+            h = hash_str(e->name) & (n - 1);
+            e->next = nb[h];
+            nb[h] = e;
+        }
+    }
+    free(buckets);
+    buckets = nb;
+    nbuckets = n;
+}
+
+static Entry *insert(const char *cmd, const char *path, unsigned int dir)
+{
+    Entry *e;
+    unsigned int h;
+
+    if (nentries + 1 > nbuckets - nbuckets / 4)
+        grow_buckets();
+
+    e = malloc(sizeof(*e));
+    e->name = strdup(cmd);
+    e->path = strdup(path);
+    e->dir = dir;
+    e->hits = 0;
+
+    h = hash_str(cmd) & (nbuckets - 1);
+    e->next = buckets[h];
+    buckets[h] = e;
+    nentries++;
+
+    return e;
+}
+
+static Entry *find(const char *cmd)
+{
+    Entry *e;
+
+    if (!nbuckets)
+        return NULL;
+
+    for (e = buckets[hash_str(cmd) & (nbuckets - 1)]; e; e = e->next)
+        if (!strcmp(e->name, cmd))
+            return e;
+
+    return NULL;
+}
+
+static Entry *search_path(const char *cmd)
+{
+    unsigned int d;
+    char probe[PATH_MAX];
+
+    for (d = 0; d < ndirs; d++)
+    {
+        if (snprintf(probe, sizeof(probe), "%s/%s", dirs[d].name, cmd) >= sizeof(probe))
+            continue;
+
+        if (access(probe, X_OK) == 0)
+        {
+            dirs_fresh(d);
+            return insert(cmd, probe, d);
+        }
+    }
+
+    return NULL;
+}
+
+/* returns the full path the command resolves to, or NULL if it cannot be
+ * found.  Names containing a '/' are never searched for in PATH.  The
+ * returned string belongs to the cache and is only valid until the next
+ * call into this module. */
+const char *path_lookup(const char *cmd)
+{
+    const char *env;
+    Entry *e;
+
+    if (strchr(cmd, '/'))
+        return access(cmd, X_OK) == 0 ? cmd : NULL;
+
+    if (!(env = env_get("PATH")))
+        env = "";
+
+    if (!path_env || strcmp(env, path_env))
+    {
+        flush_entries();
+        load_dirs(env);
+    }
+
+    /* a stale entry has been dropped by the time dirs_fresh() fails */
+    if ((e = find(cmd)) && dirs_fresh(e->dir))
+    {
+        e->hits++;
+        return e->path;
+    }
+
+    if ((e = search_path(cmd)))
+    {
+        e->hits++;
+        return e->path;
+    }
+
+    return NULL;
+}
+
+/* a new command line: directories are checked for changes again */
+void path_begin(void)
+{
+    epoch++;
+}
+
+void path_rehash(void)
+{
+    unsigned int d;
+
+    flush_entries();
+    for (d = 0; d < ndirs; d++)
+        dirs[d].stamped = 0;
+}
+
+void path_print(void)
+{
+    unsigned int i;
+    Entry *e;
+
+    if (!nentries)
+    {
+        printf("pssh: hash table empty\n");
+        return;
+    }
+
+    printf("hits    command\n");
+    for (i = 0; i < nbuckets; i++)
+        for (e = buckets[i]; e; e = e->next)
+            printf("%4u    %s\n", e->hits, e->path);
+}
@@ -0,0 +1,9 @@
+#ifndef _path_h_
+#define _path_h_
+
+const char *path_lookup(const char *cmd);
+void path_begin(void);
+void path_rehash(void);
+void path_print(void);
+
+#endif /* _path_h_ */
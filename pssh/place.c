@@ -0,0 +1,317 @@
+/* CPU and NUMA placement of jobs ('pin').
+ *
+ * A placement is a CPU list ("0-3,8"), a NUMA node ("node1": its CPUs,
+ * with the job's memory moved there) or "auto", which spreads the stages
+ * of a pipeline one per core over CPUs that share the last level cache,
+ * so data passed down the pipes stays in that cache.  Successive auto
+ * pipelines take the cache domains in turn.
+ *
+ * A new stage is started with its CPUs (see launch.c), so everything it
+ * runs or starts is placed from the first instruction.  'pin spec %job'
+ * calls sched_setaffinity() on the pids of a running job, and for a node
+ * placement migrate_pages() for the memory they already have; what they
+ * allocate later comes from the node their (now pinned) CPUs are on.
+ * glibc only declares the affinity calls and cpu_set_t for _GNU_SOURCE,
+ * so the system calls are made directly with a mask of our own. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "place.h"
+
+#define MASK_BITS (8 * sizeof(unsigned long))
+#define MAX_NODES 1024
+
+static CpuMask *domains;        /* CPUs sharing a last level cache */
+static unsigned int ndomains;
+static unsigned int next_domain;
+
+static void mask_set(CpuMask *m, unsigned int cpu)
+{
+    m->bits[cpu / MASK_BITS] |= 1UL << (cpu % MASK_BITS);
+}
+
+static int mask_isset(const CpuMask *m, unsigned int cpu)
+{
+    return (m->bits[cpu / MASK_BITS] >> (cpu % MASK_BITS)) & 1;
+}
+
+static unsigned int mask_count(const CpuMask *m)
+{
+    unsigned int cpu, n = 0;
+
+    for (cpu = 0; cpu < PLACE_MAX_CPUS; cpu++)
+        n += mask_isset(m, cpu);
+    return n;
+}
+
+/* "0-3,8,10-11" into m; returns -1 if it is not a valid, non-empty list */
+static int parse_list(const char *s, CpuMask *m)
+{
+    unsigned long lo, hi;
+    char *end;
+
+    memset(m, 0, sizeof(*m));
+    for (;;)
+    {
+        if (*s < '0' || *s > '9')
+            return -1;
+        lo = hi = strtoul(s, &end, 10);
+        if (*end == '-')
+        {
+            s = end + 1;
+            if (*s < '0' || *s > '9')
+                return -1;
+            hi = strtoul(s, &end, 10);
+        }
+        if (lo > hi || hi >= PLACE_MAX_CPUS)
+            return -1;
+
+        for (; lo <= hi; lo++)
+            mask_set(m, lo);
+
+        if (*end != ',')
+            break;
+        s = end + 1;
+    }
+
+    return *end && *end != '\n' ? -1 : 0;
+}
+
+static int read_list(const char *path, CpuMask *m)
+{
+    char buf[4096];
+    FILE *fp;
+    int rc = -1;
+
+    if (!(fp = fopen(path, "r")))
+        return -1;
+    if (fgets(buf, sizeof(buf), fp))
+        rc = parse_list(buf, m);
+    fclose(fp);
+
+    return rc;
+}
+
+static int read_int(const char *path)
+{
+    FILE *fp;
+    int n = -1;
+
+    if ((fp = fopen(path, "r")))
+    {
+        if (fscanf(fp, "%d", &n) != 1)
+            n = -1;
+        fclose(fp);
+    }
+    return n;
+}
+
+/* pid's affinity (0 for the calling thread) into m */
+int place_get(pid_t pid, CpuMask *m)
+{
+    memset(m, 0, sizeof(*m));
+    return syscall(SYS_sched_getaffinity, pid, sizeof(*m), m) < 0 ? -1 : 0;
+}
+
+int place_set(pid_t pid, const CpuMask *m)
+{
+    return syscall(SYS_sched_setaffinity, pid, sizeof(*m), m) < 0 ? -1 : 0;
+}
+
+/* the CPUs that share cpu's last level cache */
+static void cache_domain(unsigned int cpu, CpuMask *m)
+{
+    char path[128];
+    int i, level, top = -1;
+    CpuMask shared;
+
+    memset(m, 0, sizeof(*m));
+    mask_set(m, cpu);
+
+    for (i = 0;; i++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%d/level", cpu, i);
+        if ((level = read_int(path)) < 0)
+            break;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%d/shared_cpu_list", cpu, i);
+        if (level > top && !read_list(path, &shared))
+        {
+            top = level;
+            *m = shared;
+        }
+    }
+}
+
+/* splits the CPUs the shell may use into cache domains, once */
+static void load_domains(void)
+{
+    CpuMask allowed, seen, d;
+    unsigned int cpu, i;
+
+    if (ndomains)
+        return;
+
+    if (place_get(0, &allowed) == -1)
+    {
+        memset(&allowed, 0, sizeof(allowed));
+        mask_set(&allowed, 0);
+    }
+    memset(&seen, 0, sizeof(seen));
+
+    for (cpu = 0; cpu < PLACE_MAX_CPUS; cpu++)
+    {
+        if (!mask_isset(&allowed, cpu) || mask_isset(&seen, cpu))
+            continue;
+
+        cache_domain(cpu, &d);
+        for (i = 0; i < PLACE_MASK_WORDS; i++)
+        {
+            d.bits[i] &= allowed.bits[i];
+            seen.bits[i] |= d.bits[i];
+        }
+        mask_set(&d, cpu);
+        mask_set(&seen, cpu);
+
+        domains = realloc(domains, (ndomains + 1) * sizeof(*domains));
+        domains[ndomains++] = d;
+    }
+}
+
+/* 1 if the shell may run on any CPU of m, so its children can */
+static int usable(const CpuMask *m)
+{
+    CpuMask allowed;
+    unsigned int i;
+
+    if (place_get(0, &allowed) == -1)
+        return 1;
+
+    for (i = 0; i < PLACE_MASK_WORDS; i++)
+        if (m->bits[i] & allowed.bits[i])
+            return 1;
+    return 0;
+}
+
+/* the placement spec asks for, or NULL if it is not a valid one or names
+ * no CPU the shell can use */
+Placement *place_new(const char *spec)
+{
+    Placement *pl = calloc(1, sizeof(*pl));
+    char path[128], *end;
+    long node;
+
+    pl->node = -1;
+
+    if (!strcmp(spec, "auto"))
+    {
+        load_domains();
+        pl->mode = PLACE_AUTO;
+        pl->cpus = domains[next_domain++ % ndomains];
+        return pl;
+    }
+
+    if (!strncmp(spec, "node", 4))
+    {
+        node = strtol(spec + 4, &end, 10);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+        if (end != spec + 4 && !*end && node >= 0 && node < MAX_NODES &&
+            !read_list(path, &pl->cpus) && usable(&pl->cpus))
+        {
+            pl->mode = PLACE_NODE;
+            pl->node = node;
+            return pl;
+        }
+    }
+    else if (!parse_list(spec, &pl->cpus) && usable(&pl->cpus))
+    {
+        pl->mode = PLACE_CPUS;
+        return pl;
+    }
+
+    free(pl);
+    return NULL;
+}
+
+/* the n-th CPU of m, counting round */
+static unsigned int nth_cpu(const CpuMask *m, unsigned int n)
+{
+    unsigned int cpu;
+
+    n %= mask_count(m);
+    for (cpu = 0; cpu < PLACE_MAX_CPUS; cpu++)
+        if (mask_isset(m, cpu) && !n--)
+            break;
+    return cpu;
+}
+
+/* the CPUs stage 'stage' of a pipeline runs on under pl; buf is used
+ * if it needs working out */
+const CpuMask *place_cpus(const Placement *pl, unsigned int stage, CpuMask *buf)
+{
+    if (pl->mode != PLACE_AUTO)
+        return &pl->cpus;
+
+    memset(buf, 0, sizeof(*buf));
+    mask_set(buf, nth_cpu(&pl->cpus, stage));
+    return buf;
+}
+
+/* places pid, a running process of stage 'stage' of its pipeline, as pl
+ * says.  Returns -1 with errno set if its affinity could not be set. */
+int place_apply(const Placement *pl, unsigned int stage, pid_t pid)
+{
+    unsigned long from[MAX_NODES / MASK_BITS], to[MAX_NODES / MASK_BITS];
+    CpuMask m;
+
+    if (place_set(pid, place_cpus(pl, stage, &m)) == -1)
+        return -1;
+
+    /* best effort: not every kernel has NUMA, and it may be refused */
+    if (pl->mode == PLACE_NODE)
+    {
+        memset(from, 0xff, sizeof(from));
+        memset(to, 0, sizeof(to));
+        to[pl->node / MASK_BITS] = 1UL << (pl->node % MASK_BITS);
+        syscall(SYS_migrate_pages, pid, MAX_NODES, from, to);
+    }
+
+    return 0;
+}
+
+/* pid's current placement, as "cpus 0-3" plus the node pl put it on */
+void place_describe(const Placement *pl, pid_t pid, char *buf, size_t len)
+{
+    unsigned int cpu, last;
+    size_t n;
+    CpuMask m;
+
+    if (place_get(pid, &m) == -1)
+    {
+        snprintf(buf, len, "-");
+        return;
+    }
+
+    n = snprintf(buf, len, "cpus ");
+    for (cpu = 0; cpu < PLACE_MAX_CPUS && n < len; cpu++)
+    {
+        if (!mask_isset(&m, cpu))
+            continue;
+        for (last = cpu; last + 1 < PLACE_MAX_CPUS && mask_isset(&m, last + 1); last++)
+            ;
+        if (last == cpu)
+            n += snprintf(buf + n, len - n, "%s%u", buf[n - 1] == ' ' ? "" : ",", cpu);
+        else
+            n += snprintf(buf + n, len - n, "%s%u-%u", buf[n - 1] == ' ' ? "" : ",", cpu, last);
+        cpu = last;
+    }
+
+    if (pl && pl->mode == PLACE_NODE && n < len)
+        snprintf(buf + n, len - n, " node %d", pl->node);
+    else if (pl && pl->mode == PLACE_AUTO && n < len)
+        snprintf(buf + n, len - n, " (auto)");
+}
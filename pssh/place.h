@@ -0,0 +1,36 @@
+#ifndef _place_h_
+#define _place_h_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PLACE_MAX_CPUS 1024
+#define PLACE_MASK_WORDS (PLACE_MAX_CPUS / (8 * sizeof(unsigned long)))
+
+typedef struct
+{
+    unsigned long bits[PLACE_MASK_WORDS];
+} CpuMask;
+
+typedef enum
+{
+    PLACE_CPUS,     /* every stage may run on any of cpus */
+    PLACE_NODE,     /* the CPUs and memory of a NUMA node */
+    PLACE_AUTO,     /* one stage per CPU of cpus, which share a cache */
+} PlaceMode;
+
+typedef struct
+{
+    PlaceMode mode;
+    CpuMask cpus;
+    int node;       /* PLACE_NODE only, else -1 */
+} Placement;
+
+Placement *place_new(const char *spec);
+const CpuMask *place_cpus(const Placement *pl, unsigned int stage, CpuMask *buf);
+int place_get(pid_t pid, CpuMask *m);
+int place_set(pid_t pid, const CpuMask *m);
+int place_apply(const Placement *pl, unsigned int stage, pid_t pid);
+void place_describe(const Placement *pl, pid_t pid, char *buf, size_t len);
+
+#endif /* _place_h_ */
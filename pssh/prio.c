@@ -0,0 +1,149 @@
+/* CPU and I/O priority classes for jobs.
+ *
+ * A background job runs with SCHED_BATCH (its wakeups never preempt the
+ * foreground), the idle I/O class (it only gets the disk when nothing
+ * else wants it) and a nice value PRIO_BG_NICE above its own.  fg gives
+ * a job SCHED_OTHER, best effort I/O and its own nice value back, and bg
+ * takes them away again.  Foreground jobs start with the shell's own
+ * class, so only background launches cost extra system calls.
+ *
+ * A background stage is started with SCHED_BATCH (see launch.c), since
+ * the policy is not inherited from the process group and can only be set
+ * pid by pid.  Its nice value and I/O class are set once for the whole
+ * process group after the last stage has joined it (prio_started()), or
+ * pid by pid for a job without a group of its own.
+ *
+ * Anyone may switch their processes between SCHED_OTHER and SCHED_BATCH
+ * and between the best effort and idle I/O classes, but lowering a nice
+ * value needs CAP_SYS_NICE or a large enough RLIMIT_NICE.  Without one
+ * of them background jobs are not niced at all, or they would stay
+ * niced once they are brought to the foreground. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+
+#include "prio.h"
+
+/* glibc only defines it for _GNU_SOURCE */
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+
+#define PRIO_BG_NICE 10
+#define PRIO_FG_IO IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 4)
+#define PRIO_BG_IO IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)
+
+static int shell_nice;
+static int can_unnice = -1;     /* -1 until it has been worked out */
+
+/* 1 if a nice value raised from the shell's can be lowered back to it */
+static int unnice_ok(void)
+{
+    struct rlimit rl;
+
+    if (can_unnice == -1)
+    {
+        errno = 0;
+        shell_nice = getpriority(PRIO_PROCESS, 0);
+        if (errno)
+            shell_nice = 0;
+
+        can_unnice = !geteuid() ||
+                     (!getrlimit(RLIMIT_NICE, &rl) &&
+                      (rl.rlim_cur == RLIM_INFINITY || (long)rl.rlim_cur >= 20 - shell_nice));
+    }
+
+    return can_unnice;
+}
+
+static int clamp_nice(int nice)
+{
+    return nice > 19 ? 19 : nice < -20 ? -20 : nice;
+}
+
+/* the nice value job should have in the fore- or background */
+static int job_nice(Job *job, int background)
+{
+    int bg = unnice_ok() && background ? PRIO_BG_NICE : 0;
+
+    return clamp_nice(shell_nice + job->nice + bg);
+}
+
+static int set_class(pid_t pid, int background)
+{
+    struct sched_param sp;
+
+    memset(&sp, 0, sizeof(sp));
+    return sched_setscheduler(pid, background ? SCHED_BATCH : SCHED_OTHER, &sp);
+}
+
+/* sets the nice value and I/O class of job for the fore- or background.
+ * A job with a process group of its own has them set for the group,
+ * which catches whatever its stages have started too.
+ * Returns -1 with errno set if the nice value could not be set. */
+static int set_nice_io(Job *job, int background)
+{
+    unsigned int t;
+    int rc = 0;
+
+    if (job->pgid > 0)
+    {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, job->pgid, background ? PRIO_BG_IO : PRIO_FG_IO);
+        if (setpriority(PRIO_PGRP, job->pgid, job_nice(job, background)) == -1 && errno != ESRCH)
+            rc = -1;
+        return rc;
+    }
+
+    for (t = 0; t < job->npids; t++)
+    {
+        if (job->pids[t] <= 0)
+            continue;
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, job->pids[t],
+                background ? PRIO_BG_IO : PRIO_FG_IO);
+        if ((job->nice || (background && unnice_ok())) &&
+            setpriority(PRIO_PROCESS, job->pids[t], job_nice(job, background)) == -1 &&
+            errno != ESRCH)
+            rc = -1;
+    }
+
+    return rc;
+}
+
+/* finishes putting a background job, whose stages have all been started
+ * with SCHED_BATCH, in the background class.
+ * Returns -1 with errno set if the nice value could not be set. */
+int prio_started(Job *job)
+{
+    job->demoted = 1;
+    return set_nice_io(job, 1);
+}
+
+/* moves a started job to the class for the fore- or background.
+ * Returns -1 with errno set if the nice value could not be set. */
+int prio_job(Job *job, int background)
+{
+    unsigned int t;
+
+    job->demoted = background;
+    for (t = 0; t < job->npids; t++)
+    {
+        if (job->pids[t] > 0)
+            set_class(job->pids[t], background);
+    }
+
+    return set_nice_io(job, background);
+}
+
+/* renice: nice becomes job's nice value in the foreground */
+int prio_renice(Job *job, int nice)
+{
+    unnice_ok();
+    job->nice = clamp_nice(nice) - shell_nice;
+    return prio_job(job, job->demoted);
+}
@@ -0,0 +1,11 @@
+#ifndef _prio_h_
+#define _prio_h_
+
+#include <sys/types.h>
+#include "jobs.h"
+
+int prio_started(Job *job);
+int prio_job(Job *job, int background);
+int prio_renice(Job *job, int nice);
+
+#endif /* _prio_h_ */
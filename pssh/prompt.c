@@ -0,0 +1,287 @@
+/* The interactive prompt: "cwd (branch)$ ".
+ *
+ * The prompt string is kept between lines and only rebuilt when the cwd
+ * (cwd.c's generation number) or the branch shown in it changes.
+ *
+ * Finding the branch means walking up from the cwd to the nearest .git
+ * and reading HEAD, which can stall on a slow or network filesystem, so
+ * it never happens on the main thread.  A worker thread does the lookups
+ * and hands each answer back through an eventfd the event loop watches.
+ * Answers are cached per directory: the prompt is drawn at once with
+ * what was last known for the cwd, a fresh lookup is asked for every
+ * time it is shown, and if the answer differs the prompt is rebuilt and
+ * the changed() hook redraws it (stale-while-revalidate). */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "prompt.h"
+#include "cwd.h"
+#include "loop.h"
+
+#define VCS_CACHE 64
+
+typedef struct
+{
+    char *dir;
+    char *branch;       /* NULL outside a work tree */
+} VcsEntry;
+
+static VcsEntry cache[VCS_CACHE];
+static unsigned int ncache, evict;
+
+static char *prompt;
+static size_t prompt_cap;
+static unsigned int built_gen;
+static int dirty = 1;       /* rebuild even if the cwd is the same */
+static void (*prompt_changed)(void);
+
+/* shared with the worker, under lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static char *wanted;            /* directory to look up next */
+static char *busy;              /* directory being looked up */
+static char *found_dir, *found_branch;
+static int efd = -1;
+
+/* reads the first line of path into buf without the newline */
+static int read_line(const char *path, char *buf, size_t size)
+{
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* the branch checked out in the work tree rooted at dir, the short
+ * commit id if HEAD is detached, NULL if dir is not a work tree root */
+static char *head_of(const char *dir)
+{
+    char path[PATH_MAX + 16], buf[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+    if (read_line(path, buf, sizeof(buf)) == -1)
+    {
+        /* worktrees and submodules have a .git file pointing elsewhere */
+        snprintf(path, sizeof(path), "%s/.git", dir);
+        if (read_line(path, buf, sizeof(buf)) == -1 || strncmp(buf, "gitdir: ", 8))
+            return NULL;
+
+        if (buf[8] == '/')
+            snprintf(path, sizeof(path), "%s/HEAD", buf + 8);
+        else
+            snprintf(path, sizeof(path), "%s/%s/HEAD", dir, buf + 8);
+        if (read_line(path, buf, sizeof(buf)) == -1)
+            return NULL;
+    }
+
+    if (!strncmp(buf, "ref: refs/heads/", 16))
+        return strdup(buf + 16);
+    if (!strncmp(buf, "ref: ", 5))
+        return strdup(buf + 5);
+    return strndup(buf, 7);
+}
+
+/* the branch for dir, looking in dir and then in every parent */
+static char *vcs_branch(const char *dir)
+{
+    char path[PATH_MAX], *branch, *p;
+
+    snprintf(path, sizeof(path), "%s", dir);
+    while (!(branch = head_of(path)))
+    {
+        if (!(p = strrchr(path, '/')) || !path[1])
+            return NULL;
+        if (p == path)
+            path[1] = '\0';
+        else
+            *p = '\0';
+    }
+
+    return branch;
+}
+
+static void *vcs_worker(void *arg)
+{
+    char *branch;
+
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        while (!wanted)
+            pthread_cond_wait(&wake, &lock);
+        busy = wanted;
+        wanted = NULL;
+        pthread_mutex_unlock(&lock);
+
+        branch = vcs_branch(busy);
+
+        pthread_mutex_lock(&lock);
+        /* an answer the main thread has not picked up yet is superseded */
+        free(found_dir);
+        free(found_branch);
+        found_dir = busy;
+        found_branch = branch;
+        busy = NULL;
+        eventfd_write(efd, 1);
+    }
+
+    return NULL;
+}
+
+static VcsEntry *cache_find(const char *dir)
+{
+    unsigned int i;
+
+    for (i = 0; i < ncache; i++)
+    {
+        if (!strcmp(cache[i].dir, dir))
+            return &cache[i];
+    }
+
+    return NULL;
+}
+
+/* event loop callback: the worker has an answer */
+static void vcs_done(int fd, void *ctx)
+{
+    eventfd_t n;
+    VcsEntry *e;
+    char *dir, *branch;
+    int same;
+
+    eventfd_read(fd, &n);
+
+    pthread_mutex_lock(&lock);
+    dir = found_dir;
+    branch = found_branch;
+    found_dir = found_branch = NULL;
+    pthread_mutex_unlock(&lock);
+
+    if (!dir)
+        return;
+
+    if (!(e = cache_find(dir)))
+    {
+        if (ncache < VCS_CACHE)
+            e = &cache[ncache++];
+        else
+        {
+            e = &cache[evict++ % VCS_CACHE];
+            free(e->dir);
+            free(e->branch);
+        }
+        e->dir = dir;
+        e->branch = NULL;
+        dir = NULL;
+        same = !branch;
+    }
+    else
+    {
+        same = (!e->branch && !branch) || (e->branch && branch && !strcmp(e->branch, branch));
+        free(e->branch);
+    }
+    e->branch = branch;
+
+    if (!same && !strcmp(e->dir, cwd_get()))
+    {
+        dirty = 1;
+        if (prompt_changed)
+            prompt_changed();
+    }
+    free(dir);
+}
+
+/* starts the branch lookups; changed() is called when the prompt has to
+ * be redrawn because an answer came in while it was showing */
+void prompt_init(void (*changed)(void))
+{
+    pthread_attr_t attr;
+    pthread_t worker;
+    sigset_t all, old;
+
+    prompt_changed = changed;
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        return;
+
+    /* signals are the main thread's business */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&worker, &attr, vcs_worker, NULL))
+    {
+        close(efd);
+        efd = -1;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (efd != -1)
+        loop_add(efd, vcs_done, NULL);
+}
+
+/* asks for the cwd's branch to be looked up again; called whenever the
+ * prompt is about to be shown, since any command may have switched it */
+void prompt_refresh(void)
+{
+    const char *cwd = cwd_get();
+
+    if (efd == -1 || !cwd[0])
+        return;
+
+    pthread_mutex_lock(&lock);
+    if (!(busy && !strcmp(busy, cwd)) && !(wanted && !strcmp(wanted, cwd)))
+    {
+        free(wanted);
+        wanted = strdup(cwd);
+        pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* the prompt for the cwd; valid until the next call */
+const char *prompt_get(void)
+{
+    const char *cwd = cwd_get(), *branch = NULL;
+    VcsEntry *e;
+    size_t len;
+
+    if (prompt && !dirty && built_gen == cwd_generation())
+        return prompt;
+
+    if ((e = cache_find(cwd)))
+        branch = e->branch;
+
+    len = strlen(cwd) + (branch ? strlen(branch) + 3 : 0) + sizeof("$ ");
+    if (len > prompt_cap)
+    {
+        prompt_cap = len;
+        prompt = realloc(prompt, prompt_cap);
+    }
+
+    if (branch)
+        snprintf(prompt, prompt_cap, "%s (%s)$ ", cwd, branch);
+    else
+        snprintf(prompt, prompt_cap, "%s$ ", cwd);
+
+    built_gen = cwd_generation();
+    dirty = 0;
+    return prompt;
+}
@@ -0,0 +1,8 @@
+#ifndef _prompt_h_
+#define _prompt_h_
+
+void prompt_init(void (*changed)(void));
+void prompt_refresh(void);
+const char *prompt_get(void);
+
+#endif /* _prompt_h_ */
@@ -6,9 +6,30 @@
 #include <wait.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <errno.h>
 #include "builtin.h"
 #include "parse.h"
 #include "jobs.h"
+#include "path.h"
+#include "launch.h"
+#include "loop.h"
+#include "arena.h"
+#include "parallel.h"
+#include "hosts.h"
+#include "timing.h"
+#include "zygote.h"
+#include "prompt.h"
+#include "history.h"
+#include "complete.h"
+#include "glob.h"
+#include "env.h"
+#include "lex.h"
+#include "prio.h"
+#include "trace.h"
 
 /*******************************************
  * Set to 1 to view the command line parse *
@@ -18,171 +39,270 @@
 #define WRITE_SIDE 1
 #define READ_SIDE 0
 
-Job *jobs[100];
-int job_ids[100];
+JobTable jobs;
 
-/* **returns** a string used to build the prompt
- * (DO NOT JUST printf() IN HERE!)
- *
- * Note:
- *   If you modify this function to return a string on the heap,
- *   be sure to free() it later when appropirate!  */
-static char *build_prompt()
+/* interactive: prompt with readline and report job state changes.
+ * job_control: give every job its own process group and the terminal.
+ * Both are off when running a script, -c string or piped input. */
+static int interactive;
+static int job_control;
+
+/* exit status of the last foreground job, returned when the shell exits */
+static int last_status;
+
+/* terminal modes to restore whenever the shell gets the terminal back */
+static struct termios shell_tmodes;
+
+/* all allocations for the line being run */
+static Arena line_arena;
+
+/* Job state change reports are queued here instead of being printed
+ * straight away, so they can be shown in one go without trampling on
+ * the line the user is typing */
+static char *reports;
+static size_t reports_len, reports_cap;
+
+static void report(const char *fmt, ...)
 {
-    char *full;
-    char *cwd;
-    char prompt[] = "$ ";
-    if ((cwd = getcwd(NULL, 0)))
+    va_list ap;
+    int n;
+
+    if (!interactive)
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (reports_len + n + 1 > reports_cap)
     {
-        full = malloc(strlen(cwd) + strlen(prompt) + 1);
-        sprintf(full, "%s%s", cwd, prompt);
-        free(cwd);
-        return full;
+        reports_cap = (reports_len + n + 1) * 2;
+        reports = realloc(reports, reports_cap);
     }
 
-    return "$ ";
+    va_start(ap, fmt);
+    vsnprintf(reports + reports_len, n + 1, fmt, ap);
+    va_end(ap);
+    reports_len += n;
 }
 
-void handler(int sig)
+static int prompt_active;
+
+static void flush_reports()
 {
-    pid_t chld, old_fg_pgrp;
-    int status;
-    int job_id;
+    if (!reports_len)
+        return;
 
-    switch (sig)
+    if (prompt_active)
+        rl_clear_visible_line();
+    else
+        putchar('\n');
+
+    fputs(reports, stdout);
+    fflush(stdout);
+    reports_len = 0;
+
+    if (prompt_active)
+        rl_forced_update_display();
+}
+
+/* the foreground job has stopped or finished: take the terminal back */
+static void release_terminal(Job *job)
+{
+    if (jobs.fg != job)
+        return;
+
+    jobs.fg = NULL;
+    if (!job_control)
+        return;
+
+    set_fg_pgrp(0);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+}
+
+/* a timed job's report goes straight to stderr when it ran in the
+ * foreground and is queued like any other report otherwise */
+static void report_timing(Job *job)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    if (job->status != BG || !interactive)
+    {
+        timing_report(job->timing, job->exit_status, stderr);
+        return;
+    }
+
+    if (!(fp = open_memstream(&buf, &len)))
+        return;
+    timing_report(job->timing, job->exit_status, fp);
+    fclose(fp);
+    report("%s", buf);
+    free(buf);
+}
+
+/* code and status are the si_code (CLD_*) and si_status of pid's state
+ * change */
+static void job_changed(Job *job, pid_t pid, int code, int status)
+{
+    switch (code)
     {
-    case SIGCHLD:
-        while ((chld = waitpid(-1, &status, WNOHANG | WCONTINUED | WUNTRACED)) > 0)
+    case CLD_CONTINUED:
+        /* child state changed from STOPPED to RUNNING (received SIGCONT) */
+        if (!(job->continued++))
         {
-            job_id = find_jid(jobs, chld);
-            if (WIFCONTINUED(status))
-            {
-                /* child state changed from STOPPED to RUNNING (received SIGCONT) */
-                old_fg_pgrp = tcgetpgrp(STDOUT_FILENO);
-                set_fg_pgrp(0);
-                if (!(jobs[job_id]->continued++))
-                {
-                    printf("\n[%d] + continued   %s\n", job_id, jobs[job_id]->name);
-                    fflush(stdout);
-                }
-                else if (jobs[job_id]->continued == jobs[job_id]->npids)
-                {
-                    jobs[job_id]->continued = 0;
-                }
-                set_fg_pgrp(old_fg_pgrp);
-            }
-            else if (WIFSTOPPED(status))
-            {
-                /* child state changed to STOPPED (received SIGSTOP, SIGTTOU, or SIGTTIN) */
-                set_fg_pgrp(0);
-                jobs[job_id]->status = STOPPED;
-                if (!(jobs[job_id]->suspended++))
-                {
-                    printf("\n[%d] + suspended   %s\n", job_id, jobs[job_id]->name);
-                    fflush(stdout);
-                }
-                if (jobs[job_id]->suspended >= jobs[job_id]->npids)
-                {
-                    jobs[job_id]->suspended = 0;
-                }
-            }
-            else if (WIFEXITED(status))
-            {
-                /* child exited normally */
-                set_fg_pgrp(0);
-                jobs[job_id]->completed++;
-                if (jobs[job_id]->completed == jobs[job_id]->npids)
-                {
-                    if (jobs[job_id]->status == BG)
-                    {
-                        printf("\n[%d] + done   %s\n", job_id, jobs[job_id]->name);
-                        fflush(stdout);
-                    }
-                    free_job_safe(jobs, jobs[job_id], job_ids);
-                }
-            }
-            else if (WIFSIGNALED(status))
-            {
-                /* child exited due to uncaught signal */
-                set_fg_pgrp(0);
-                jobs[job_id]->completed++;
-                if (jobs[job_id]->completed == jobs[job_id]->npids)
-                {
-                    if (jobs[job_id]->status == BG)
-                    {
-                        printf("\n[%d] + done   %s\n", job_id, jobs[job_id]->name);
-                        fflush(stdout);
-                    }
-                    free_job_safe(jobs, jobs[job_id], job_ids);
-                }
-            }
-            else
-            {
-                /* waited on terminated child */
-                printf("Parent: Child %d else!\n", chld);
-                set_fg_pgrp(0);
-            }
+            report("[%d] + continued   %s\n", job->jid, job->name);
+        }
+        if (job->continued >= job->npids)
+        {
+            job->continued = 0;
         }
         break;
-    case SIGTTIN:
-    case SIGTTOU:
-        while (tcgetpgrp(STDOUT_FILENO) != getpgrp())
-            pause();
+    case CLD_STOPPED:
+    case CLD_TRAPPED:
+        /* child state changed to STOPPED (received SIGSTOP, SIGTTOU, or SIGTTIN) */
+        job->status = STOPPED;
+        release_terminal(job);
+        if (!(job->suspended++))
+        {
+            report("[%d] + suspended   %s\n", job->jid, job->name);
+        }
+        if (job->suspended >= job->npids)
+        {
+            job->suspended = 0;
+        }
         break;
     default:
-        // printf("Other signal\n");
+        /* child exited normally or due to an uncaught signal */
+        job->completed++;
+        if (pid == job->pids[job->npids - 1])
+            job->exit_status = code == CLD_EXITED ? status : 128 + status;
+        if (job->completed == job->npids)
+        {
+            if (job->status != BG)
+                last_status = job->exit_status;
+            if (job->status == BG && !job->done)
+            {
+                report("[%d] + done   %s\n", job->jid, job->name);
+            }
+            if (job->timing)
+                report_timing(job);
+            release_terminal(job);
+            if (job->done && job->done(job->done_ctx, job->exit_status))
+                break;
+            free_job_safe(&jobs, job);
+        }
         break;
     }
 }
 
-void print_banner()
+static unsigned int stage_of(Job *job, pid_t pid)
 {
-    printf("                    ________   \n");
-    printf("_________________________  /_  \n");
-    printf("___  __ \\_  ___/_  ___/_  __ \\ \n");
-    printf("__  /_/ /(__  )_(__  )_  / / / \n");
-    printf("_  .___//____/ /____/ /_/ /_/  \n");
-    printf("/_/ Type 'exit' or ctrl+c to quit\n\n");
+    unsigned int i;
+
+    for (i = 0; i < job->npids - 1 && job->pids[i] != pid; i++)
+        ;
+    return i;
 }
 
-/* return true if command is found, either:
- *   - a valid fully qualified path was supplied to an existing file
- *   - the executable file was found in the system's PATH
- * false is returned otherwise */
-static int command_found(const char *cmd)
+/* the stages of a timed job are reaped with wait4() for their rusage.
+ * pid cannot have been reused: it stays a zombie until this call. */
+static void reap_timed(Job *job, pid_t pid)
 {
-    char *dir;
-    char *tmp;
-    char *PATH;
-    char *state;
-    char probe[PATH_MAX];
+    unsigned long long span = trace_begin();
+    struct rusage ru;
+    int status;
 
-    int ret = 0;
+    if (wait4(pid, &status, WNOHANG, &ru) <= 0)
+        return;
 
-    if (access(cmd, X_OK) == 0)
-        return 1;
+    timing_stop(job->timing, stage_of(job, pid), &ru);
+    if (WIFEXITED(status))
+        job_changed(job, pid, CLD_EXITED, WEXITSTATUS(status));
+    else
+        job_changed(job, pid, CLD_KILLED, WTERMSIG(status));
+    trace_end(span, "reap", NULL, "pid", pid);
+}
 
-    PATH = strdup(getenv("PATH"));
+/* one of job's processes exited: its pidfd became readable.  The wakeup
+ * goes straight to the owning job without looking anything up.  A reaped
+ * process's pidfd stays readable, so it leaves the loop (it is closed
+ * with the job). */
+static void child_exited(int fd, void *ctx)
+{
+    unsigned long long span = trace_begin();
+    Job *job = ctx;
+    siginfo_t info;
+    unsigned int i;
 
-    for (tmp = PATH;; tmp = NULL)
+    loop_del(fd);
+
+    /* reap_timed() may free job: it must not be looked at again */
+    if (job->timing)
     {
-        dir = strtok_r(tmp, ":", &state);
-        if (!dir)
-            break;
+        for (i = 0; i < job->npids && job->pidfds[i] != fd; i++)
+            ;
+        if (i < job->npids)
+            reap_timed(job, job->pids[i]);
+        return;
+    }
 
-        strncpy(probe, dir, PATH_MAX - 1);
-        strncat(probe, "/", PATH_MAX - 1);
-        strncat(probe, cmd, PATH_MAX - 1);
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PIDFD, fd, &info, WEXITED | WNOHANG) == -1 || !info.si_pid)
+        return;
 
-        if (access(probe, X_OK) == 0)
-        {
-            ret = 1;
+    job_changed(job, info.si_pid, info.si_code, info.si_status);
+    trace_end(span, "reap", NULL, "pid", info.si_pid);
+}
+
+/* SIGCHLD is blocked and delivered through a signalfd.  Exits are
+ * normally picked up through pidfds, so only stops and continues are
+ * collected here, unless some child could not get a pidfd. */
+static void reap_children(int sfd, void *ctx)
+{
+    unsigned long long span = trace_begin();
+    struct signalfd_siginfo ssi;
+    siginfo_t info;
+    int options = WSTOPPED | WCONTINUED | WNOHANG;
+    int reaped = 0;
+    Job *job;
+
+    while (read(sfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+        ;
+
+    if (jobs.untracked)
+        options |= WEXITED;
+
+    while (1)
+    {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, options) == -1 || !info.si_pid)
             break;
-        }
+        reaped++;
+
+        if (!(job = job_get(&jobs, find_jid(&jobs, info.si_pid))))
+            continue;
+
+        /* a timed stage reaped here instead of through its pidfd: its
+         * usage is lost with waitid() */
+        if (job->timing && (info.si_code == CLD_EXITED ||
+                            info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED))
+            timing_stop(job->timing, stage_of(job, info.si_pid), NULL);
+        job_changed(job, info.si_pid, info.si_code, info.si_status);
     }
 
-    free(PATH);
-    return ret;
+    trace_end(span, "sigchld", NULL, "reaped", reaped);
+}
+
+void print_banner()
+{
+    printf("                    ________   \n");
+    printf("_________________________  /_  \n");
+    printf("___  __ \\_  ___/_  ___/_  __ \\ \n");
+    printf("__  /_/ /(__  )_(__  )_  / / / \n");
+    printf("_  .___//____/ /____/ /_/ /_/  \n");
+    printf("/_/ Type 'exit' or ctrl+c to quit\n\n");
 }
 
 static void redirect(int fd_old, int fd_new)
@@ -200,18 +320,16 @@ static int close_safe(int fd)
 
     return -1;
 }
-static void run(Task *T, int in, int out)
+static int run(Parse *P, Task *T, int in, int out)
 {
+    int status;
+
     redirect(STDIN_FILENO, in);
     redirect(STDOUT_FILENO, out);
 
-    if (is_builtin(T->cmd))
-    {
-        builtin_execute(*T, jobs, job_ids);
-        free_job_safe(jobs, jobs[find_jid(jobs, getpid())], job_ids);
-    }
-    else if (command_found(T->cmd))
-        execvp(T->cmd, T->argv);
+    status = builtin_execute(*T, P, &jobs);
+    fflush(stdout);
+    return status;
 }
 static int get_infile(Parse *P)
 {
@@ -227,53 +345,89 @@ static int get_outfile(Parse *P)
     else
         return STDOUT_FILENO;
 }
+/* runs a lone builtin in the shell process.  Its redirections are put
+ * on the shell's own stdin and stdout and undone afterwards. */
+static int run_builtin(Parse *P)
+{
+    Task *T = &P->tasks[0];
+    int saved_in = -1, saved_out = -1;
+    int status;
+
+    if (!(builtin_flags(T->cmd) & BUILTIN_OWN_IO))
+    {
+        if (P->infile)
+        {
+            saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+            redirect(STDIN_FILENO, get_infile(P));
+        }
+        if (P->outfile)
+        {
+            fflush(stdout);
+            saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+            redirect(STDOUT_FILENO, get_outfile(P));
+        }
+    }
+
+    status = builtin_execute(*T, P, &jobs);
+    fflush(stdout);
+
+    if (saved_out != -1)
+        redirect(STDOUT_FILENO, saved_out);
+    if (saved_in != -1)
+        redirect(STDIN_FILENO, saved_in);
+
+    return status;
+}
+
+/* returns 1 if P should be run as a job, 0 if it cannot be run and 2 if
+ * it was a builtin that has already been run in the shell */
 static int is_possible(Parse *P)
 {
+    unsigned long long span;
+    const char *path;
     unsigned int t;
     Task *T;
-    int fd;
+    int fd, found;
 
+    /* each task is looked up once here; start_task() uses T->path */
+    path_begin();
     for (t = 0; t < P->ntasks; t++)
     {
         T = &P->tasks[t];
-        if (!is_builtin(T->cmd) && !command_found(T->cmd))
+        span = trace_begin();
+        if (!is_builtin(T->cmd) && (path = path_lookup(T->cmd)))
+            T->path = arena_strdup(&line_arena, path);
+        found = is_builtin(T->cmd) || T->path;
+        trace_end(span, "path_lookup", T->cmd, "found", found);
+        if (!found)
         {
             fprintf(stderr, "pssh: command not found: %s\n", T->cmd);
+            last_status = 127;
             return 0;
         }
 
-        if (!strcmp(T->cmd, "exit"))
-        {
-            printf("Exiting...\n");
-            exit(EXIT_SUCCESS);
-        }
-        else if (!strcmp(T->cmd, "jobs"))
-        {
-            builtin_jobs(jobs, job_ids);
-            return 2;
-        }
-        else if (!strcmp(T->cmd, "fg"))
-        {
-            builtin_fg(*T, jobs, job_ids);
-            return 2;
-        }
-        else if (!strcmp(T->cmd, "bg"))
-        {
-            builtin_bg(*T, jobs, job_ids);
-            return 2;
-        }
-        else if (!strcmp(T->cmd, "kill"))
+        if (P->ntasks > 1 && (builtin_flags(T->cmd) & BUILTIN_SHELL))
         {
-            builtin_kill(*T, jobs, job_ids);
-            return 2;
+            fprintf(stderr, "pssh: %s: cannot be used in a pipeline\n", T->cmd);
+            last_status = 2;
+            return 0;
         }
     }
 
+    T = &P->tasks[0];
+    if (!strcmp(T->cmd, "exit"))
+    {
+        if (interactive)
+            printf("Exiting...\n");
+        exit(T->argv[1] ? atoi(T->argv[1]) : last_status);
+    }
+
     if (P->infile)
     {
         if (access(P->infile, R_OK) != 0)
         {
             fprintf(stderr, "pssh: no such file or directory: %s\n", P->infile);
+            last_status = 1;
             return 0;
         }
     }
@@ -283,11 +437,20 @@ static int is_possible(Parse *P)
         if ((fd = creat(P->outfile, 0666)) == -1)
         {
             fprintf(stderr, "pssh: permission denied: %s\n", P->outfile);
+            last_status = 1;
             return 0;
         }
         close(fd);
     }
 
+    if (P->ntasks == 1 && is_builtin(T->cmd))
+    {
+        span = trace_begin();
+        last_status = run_builtin(P);
+        trace_end(span, "builtin", T->cmd, "status", last_status);
+        return 2;
+    }
+
     return 1;
 }
 void print_job_pids(Job *job)
@@ -300,31 +463,105 @@ void print_job_pids(Job *job)
     }
     printf("\n");
 }
+/* starts one stage of a job in process group pgid (0 for the first stage,
+ * -1 to stay in the shell's group) and with attrs, in the foreground of
+ * the terminal unless the job runs in the background.  External commands
+ * go through the selected launch backend; builtins in a pipeline need a
+ * copy of the shell, so they are forked. */
+static pid_t start_task(Parse *P, Task *T, int in, int out, int close_fd, pid_t pgid,
+                        const LaunchAttrs *attrs)
+{
+    unsigned long long span = trace_begin();
+    int foreground = !P->background && job_control;
+    pid_t pid;
+
+    if (!is_builtin(T->cmd))
+    {
+        pid = launch_exec(launch_mode, T->path, T->argv,
+                          T->assigns ? env_overlay(&line_arena, T->assigns, T->nassigns)
+                                     : env_vector(),
+                          in, out, STDERR_FILENO, close_fd, pgid, foreground, attrs);
+        trace_end(span, "exec", T->cmd, "pid", pid);
+        return pid;
+    }
+
+    /* or the child writes out the shell's pending output a second time */
+    fflush(stdout);
+    if ((pid = fork()))
+    {
+        trace_end(span, "fork", T->cmd, "pid", pid);
+        return pid;
+    }
+
+    if (pgid >= 0)
+        setpgid(0, pgid);
+    if (foreground)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    launch_reset_signals();
+    launch_apply(attrs);
+    if (close_fd >= 0)
+        close(close_fd);
+
+    /* never return into the child's copy of the shell */
+    _exit(run(P, T, in, out));
+}
+
+static void watch_pid(Job *job, unsigned int t, pid_t pid)
+{
+    job_add_pid(&jobs, job, t, pid);
+
+    if (!job_control)
+        return;
+
+    setpgid(job->pids[t], job->pids[0]);
+    job->pgid = job->pids[0];
+}
+
+static pid_t stage_pgid(Job *job, unsigned int t)
+{
+    if (!job_control)
+        return -1;
+
+    return t ? job->pids[0] : 0;
+}
+
+/* what stage t of job is started with: the CPUs it is placed on and,
+ * in the background, SCHED_BATCH (prio.c) */
+static const LaunchAttrs *stage_attrs(Job *job, unsigned int t, int background,
+                                      LaunchAttrs *attrs, CpuMask *buf)
+{
+    attrs->cpus = job->place ? place_cpus(job->place, t, buf) : NULL;
+    attrs->batch = background;
+    return attrs;
+}
+
 /* Called upon receiving a successful parse.
  * This function is responsible for cycling through the
  * tasks, and forking, executing, etc as necessary to get
  * the job done! */
-void execute_tasks(Parse *P, int job_id)
+void execute_tasks(Parse *P, Job *job)
 {
+    LaunchAttrs attrs;
+    CpuMask cpus;
     unsigned int t;
     int fd[2];
     int in, out;
+    pid_t pid;
 
     in = get_infile(P);
     for (t = 0; t < P->ntasks - 1; t++)
     {
         pipe(fd);
-        jobs[job_id]->pids[t] = fork();
-        setpgid(jobs[job_id]->pids[t], jobs[job_id]->pids[0]);
-        jobs[job_id]->pgid = getpgid(jobs[job_id]->pids[0]);
-        if (!P->background)
-            set_fg_pgrp(jobs[job_id]->pids[0]);
+        if (job->timing)
+            timing_start(job->timing, t);
+        pid = start_task(P, &P->tasks[t], in, fd[WRITE_SIDE], fd[READ_SIDE],
+                         stage_pgid(job, t), stage_attrs(job, t, P->background, &attrs, &cpus));
+        if (pid == -1)
+            job->completed++;
+        watch_pid(job, t, pid);
+        if (!P->background && job_control)
+            set_fg_pgrp(job->pids[0]);
 
-        if (!jobs[job_id]->pids[t])
-        {
-            close(fd[READ_SIDE]);
-            run(&P->tasks[t], in, fd[WRITE_SIDE]);
-        }
         close(fd[WRITE_SIDE]);
         close_safe(in);
 
@@ -333,81 +570,436 @@ void execute_tasks(Parse *P, int job_id)
 
     out = get_outfile(P);
 
-    jobs[job_id]->pids[t] = fork();
-
-    setpgid(jobs[job_id]->pids[t], jobs[job_id]->pids[0]);
+    if (job->timing)
+        timing_start(job->timing, t);
+    pid = start_task(P, &P->tasks[t], in, out, -1, stage_pgid(job, t),
+                     stage_attrs(job, t, P->background, &attrs, &cpus));
+    if (pid == -1)
+        job->completed++;
+    watch_pid(job, t, pid);
+    if (P->background)
+        prio_started(job);
     if (!P->background)
     {
-        set_fg_pgrp(jobs[job_id]->pids[0]);
+        jobs.fg = job;
+        if (job_control)
+            set_fg_pgrp(job->pids[0]);
     }
-    else if (P->background && jobs[job_id]->pids[t])
+    else if (interactive)
+        print_bg_job(job);
+
+    close_safe(in);
+    close_safe(out);
+
+    /* nothing was started that could ever be reaped */
+    if (job->completed == job->npids)
     {
-        print_bg_job(jobs[job_id], job_id);
+        release_terminal(job);
+        free_job_safe(&jobs, job);
     }
+}
+
+/* the value of $NAME for the lexer, and of $? and $$ */
+static const char *lookup_var(const char *name, size_t len)
+{
+    static char num[16];
 
-    if (!jobs[job_id]->pids[t])
-        run(&P->tasks[t], in, out);
+    if (len == 1 && (*name == '?' || *name == '$'))
+    {
+        snprintf(num, sizeof(num), "%d", *name == '?' ? last_status : (int)getpid());
+        return num;
+    }
 
-    // for (t = 0; t < P->ntasks; t++)
-    // {
-    //     waitpid(jobs[job_id]->pids[t], NULL, 0);
-    // }
-    close_safe(in);
-    // set_fg_pgrp(0);
-    // printf("Parent: Child %d leader!\n", jobs[job_id]->pids[0]);
+    return env_getn(name, len);
 }
 
-int main(int argc, char **argv)
+/* 'time [-j] pipeline': takes the prefix off P's first task and returns
+ * 1 if it was there, with *json set for -j */
+static int strip_time(Parse *P, int *json)
+{
+    Task *T = &P->tasks[0];
+
+    *json = 0;
+    if (!P->ntasks || strcmp(T->cmd, "time"))
+        return 0;
+
+    T->argv++;
+    if (T->argv[0] && !strcmp(T->argv[0], "-j"))
+    {
+        *json = 1;
+        T->argv++;
+    }
+    T->cmd = T->argv[0];
+
+    return 1;
+}
+
+/* 'pin <cpulist|nodeN|auto> pipeline': takes the prefix off P's first
+ * task and returns 1 if it was there, with *place set to the placement
+ * (NULL if it is not a valid one).  'pin spec %job' is left to the
+ * builtin. */
+static int strip_pin(Parse *P, Placement **place)
 {
-    char *cmdline;
-    char *full_cmdline;
+    Task *T = &P->tasks[0];
+
+    *place = NULL;
+    if (strcmp(T->cmd, "pin") || !T->argv[1] || !T->argv[2] || T->argv[2][0] == '%')
+        return 0;
+
+    *place = place_new(T->argv[1]);
+    T->argv += 2;
+    T->cmd = T->argv[0];
+
+    return 1;
+}
+
+static void run_cmdline(char *cmdline)
+{
+    PipelineTime *timing = NULL;
+    Placement *place = NULL;
+    struct rusage before, ru;
+    unsigned long long span;
     Parse *P;
-    int next_id;
-    memset(job_ids, 0, 100 * sizeof(int));
-    memset(jobs, 0, 100 * sizeof(Job *));
+    Job *job;
+    unsigned int i;
+    int json;
 
-    signal(SIGCHLD, handler);
-    signal(SIGTTOU, handler);
-    signal(SIGTTIN, handler);
+    span = trace_begin();
+    P = parse_cmdline(&line_arena, cmdline);
+    trace_end(span, "parse_cmdline", NULL, "tasks", P ? P->ntasks : 0);
 
-    print_banner();
+    if (!P)
+        goto next;
 
-    while (1)
+    if (P->invalid_syntax)
     {
-        cmdline = readline(build_prompt());
-        full_cmdline = malloc(strlen(cmdline) + 1);
-        strcpy(full_cmdline, cmdline);
+        printf("pssh: invalid syntax\n");
+        last_status = 2;
+        goto next;
+    }
 
-        if (!cmdline) /* EOF (ex: ctrl-d) */
-            exit(EXIT_SUCCESS);
-        P = parse_cmdline(cmdline);
+    /* NAME=value alone sets a shell variable */
+    if (!P->tasks[0].cmd)
+    {
+        for (i = 0; i < P->tasks[0].nassigns; i++)
+            env_put(P->tasks[0].assigns[i], 0);
+        last_status = 0;
+        goto next;
+    }
 
-        if (!P)
-            goto next;
+    glob_expand(&line_arena, P);
 
-        if (P->invalid_syntax)
+    if (strip_time(P, &json))
+    {
+        if (!P->tasks[0].cmd)
         {
-            printf("pssh: invalid syntax\n");
+            fprintf(stderr, "usage: time [-j] pipeline\n");
+            last_status = 2;
             goto next;
         }
-        if (is_possible(P) != 1)
-            goto next;
-        if ((next_id = next_jid(job_ids)) < 0)
+
+        /* builtins that is_possible() runs in the shell are timed as the
+         * shell itself; the stages of a job restart their clocks */
+        timing = timing_new(P, json);
+        timing_start(timing, 0);
+        timing_usage(&before);
+    }
+
+    if (strip_pin(P, &place) && !place)
+    {
+        fprintf(stderr, "pssh: pin: %s: no such CPUs or node\n", P->tasks[0].argv[-1]);
+        timing_free(timing);
+        last_status = 2;
+        goto next;
+    }
+
+    switch (is_possible(P))
+    {
+    case 2:
+        if (timing)
         {
-            printf("pssh: job buffer is full\n");
-            goto next;
+            timing_usage(&ru);
+            timing_since(&ru, &before);
+            timing_stop(timing, 0, &ru);
+            timing_report(timing, last_status, stderr);
         }
+        /* fall through */
+    case 0:
+        timing_free(timing);
+        free(place);
+        goto next;
+    }
 
 #if DEBUG_PARSE
-        printf("debug parse\n");
-        parse_debug(P);
+    printf("debug parse\n");
+    parse_debug(P);
 #endif
 
-        jobs[next_id] = new_job(full_cmdline, P);
-        execute_tasks(P, next_id);
+    job = new_job(cmdline, P);
+    job->timing = timing;
+    job->place = place;
+    job_insert(&jobs, job);
+    execute_tasks(P, job);
+
+next:
+    arena_reset(&line_arena);
+}
+
+static void read_input(int fd, void *ctx)
+{
+    rl_callback_read_char();
+}
+
+static void prompt_install();
+
+static void prompt_remove()
+{
+    if (!prompt_active)
+        return;
+
+    rl_callback_handler_remove();
+    loop_del(STDIN_FILENO);
+    prompt_active = 0;
+}
+
+static void handle_line(char *cmdline)
+{
+    if (!cmdline) /* EOF (ex: ctrl-d) */
+    {
+        prompt_remove();
+        printf("\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    /* the terminal belongs to whatever runs next; the prompt is put
+     * back by the main loop once there is no foreground job */
+    trace_mark("readline", NULL, "length", strlen(cmdline));
+    prompt_remove();
+    history_add(cmdline);
+    run_cmdline(cmdline);
+    free(cmdline);
+}
+
+static void prompt_install()
+{
+    if (prompt_active)
+        return;
+
+    prompt_refresh();
+    rl_callback_handler_install(prompt_get(), handle_line);
+
+    loop_add(STDIN_FILENO, read_input, NULL);
+    prompt_active = 1;
+    trace_mark("prompt", NULL, NULL, 0);
+}
+
+/* the prompt changed while it was on screen (a branch lookup came
+ * back different): draw it again */
+static void prompt_changed()
+{
+    if (!prompt_active)
+        return;
+
+    rl_clear_visible_line();
+    rl_set_prompt(prompt_get());
+    rl_forced_update_display();
+}
+
+/* job control is only possible once the shell is in the foreground of
+ * its terminal; wait for that (as a stopped background job) first */
+static void init_terminal()
+{
+    pid_t pgrp;
+
+    if (!isatty(STDIN_FILENO))
+        return;
+
+    while (tcgetpgrp(STDIN_FILENO) != (pgrp = getpgrp()))
+        kill(-pgrp, SIGTTIN);
+
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+}
+
+static void wait_foreground()
+{
+    while (jobs.fg)
+    {
+        trace_flush();
+        loop_run_once(-1);
+    }
+}
+
+/* Non-interactive mode: read commands with a buffered getline() and run
+ * each one to completion before reading the next */
+static int run_batch(FILE *fp)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &cap, fp)) != -1)
+    {
+        if (n && line[n - 1] == '\n')
+            line[n - 1] = '\0';
+
+        run_cmdline(line);
+        wait_foreground();
+        trace_flush();
+    }
+
+    free(line);
+    return last_status;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-c command | script]\n"
+                    "       %s -h hostfile [-p N] [-t secs] [-a] command [args]\n",
+            argv0, argv0);
+    exit(2);
+}
+
+/* pssh -h hostfile: run one command on every host in the file and exit */
+static int run_hosts(const char *hostfile, char **argv, HostsOpts *opts)
+{
+    char **hosts, *cmd;
+    unsigned int nhosts;
+    int failed;
+
+    if (!(hosts = hosts_load(hostfile, &nhosts)))
+    {
+        fprintf(stderr, "pssh: %s: %s\n", hostfile, strerror(errno));
+        return 127;
+    }
+
+    cmd = parallel_join(argv);
+    failed = hosts_run(hosts, nhosts, cmd, opts, &jobs);
+    free(cmd);
+    hosts_free(hosts, nhosts);
+
+    return failed > 101 ? 101 : failed;
+}
+
+int main(int argc, char **argv)
+{
+    sigset_t chld_mask;
+    FILE *batch = NULL;
+    char *command = NULL, *hostfile = NULL;
+    HostsOpts opts = {HOSTS_DEFAULT_POOL, 0, 0, 0};
+    int sfd, opt;
+
+    /* this process is the launch zygote started by another pssh */
+    if (!strcmp(argv[0], ZYGOTE_ARGV0))
+        return zygote_main(argc, argv);
+
+    env_init();
+    lex_set_lookup(lookup_var);
+
+    while ((opt = getopt(argc, argv, "+c:h:p:t:a")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            command = optarg;
+            break;
+        case 'h':
+            hostfile = optarg;
+            break;
+        case 'p':
+            if (atoi(optarg) <= 0)
+                usage(argv[0]);
+            opts.pool = atoi(optarg);
+            break;
+        case 't':
+            opts.timeout_ms = atof(optarg) * 1000;
+            break;
+        case 'a':
+            opts.aggregate = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (hostfile)
+    {
+        if (command || optind == argc)
+            usage(argv[0]);
+    }
+    else if (command)
+    {
+        if (optind != argc)
+            usage(argv[0]);
+        batch = fmemopen(command, strlen(command), "r");
+    }
+    else if (optind < argc)
+    {
+        if (optind + 1 != argc)
+            usage(argv[0]);
+        if (!(batch = fopen(argv[optind], "r")))
+        {
+            fprintf(stderr, "pssh: %s: %s\n", argv[optind], strerror(errno));
+            exit(127);
+        }
+    }
+    else if (!isatty(STDIN_FILENO))
+    {
+        batch = stdin;
+    }
+    else
+    {
+        interactive = job_control = 1;
+        init_terminal();
+    }
+
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, NULL);
+
+    loop_init();
+    jobs.exited = child_exited;
+    if ((sfd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+    {
+        perror("pssh: signalfd");
+        exit(EXIT_FAILURE);
+    }
+    loop_add(sfd, reap_children, NULL);
+
+    /* not passed on, or a pssh started from this one would write over it */
+    if (env_get("PSSH_TRACE"))
+    {
+        if (trace_start(env_get("PSSH_TRACE")) == -1)
+            fprintf(stderr, "pssh: %s: %s\n", env_get("PSSH_TRACE"), strerror(errno));
+        env_unset("PSSH_TRACE");
+    }
+
+    if (env_get("PSSH_LAUNCH") && launch_set_mode(env_get("PSSH_LAUNCH")) == -1)
+        fprintf(stderr, "pssh: unknown launch mode: %s\n", env_get("PSSH_LAUNCH"));
+
+    if (hostfile)
+        exit(run_hosts(hostfile, argv + optind, &opts));
+
+    if (batch)
+        exit(run_batch(batch));
+
+    print_banner();
+    prompt_init(prompt_changed);
+    history_init();
+    complete_init();
+
+    while (1)
+    {
+        if (!jobs.fg)
+        {
+            flush_reports();
+            prompt_install();
+        }
 
-    next:
-        parse_destroy(&P);
-        free(cmdline);
+        trace_flush();
+        loop_run_once(-1);
+        flush_reports();
     }
 }
@@ -0,0 +1,235 @@
+/* Per-stage accounting for the 'time' prefix.
+ *
+ * A stage's clock starts right before it is forked and stops when it is
+ * reaped, so its wall time includes what it cost to start it.  Timed jobs
+ * are reaped with wait4(), which hands back the child's own rusage; the
+ * pipeline total adds up the stages' CPU time, context switches and
+ * faults, takes the largest resident set and runs from the first start
+ * to the last reap. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+
+PipelineTime *timing_new(Parse *P, int json)
+{
+    PipelineTime *pt = malloc(sizeof(*pt));
+    unsigned int i, j;
+    size_t len;
+    char *d;
+
+    pt->nstages = P->ntasks;
+    pt->stages = calloc(P->ntasks, sizeof(*pt->stages));
+    pt->json = json;
+
+    for (i = 0; i < pt->nstages; i++)
+    {
+        for (len = 1, j = 0; P->tasks[i].argv[j]; j++)
+            len += strlen(P->tasks[i].argv[j]) + 1;
+
+        d = pt->stages[i].cmd = malloc(len);
+        *d = '\0';
+        for (j = 0; P->tasks[i].argv[j]; j++)
+        {
+            if (j)
+                *d++ = ' ';
+            d = stpcpy(d, P->tasks[i].argv[j]);
+        }
+    }
+
+    return pt;
+}
+
+void timing_start(PipelineTime *pt, unsigned int i)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pt->stages[i].start);
+}
+
+/* stage i was reaped; ru is its usage, or NULL if it is not known */
+void timing_stop(PipelineTime *pt, unsigned int i, const struct rusage *ru)
+{
+    StageTime *s = &pt->stages[i];
+
+    clock_gettime(CLOCK_MONOTONIC, &s->end);
+    if (ru)
+        s->ru = *ru;
+    s->reaped = 1;
+}
+
+static double tv_secs(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double ts_diff(const struct timespec *end, const struct timespec *start)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void tv_add(struct timeval *a, const struct timeval *b)
+{
+    a->tv_sec += b->tv_sec;
+    a->tv_usec += b->tv_usec;
+    if (a->tv_usec >= 1000000)
+    {
+        a->tv_sec++;
+        a->tv_usec -= 1000000;
+    }
+}
+
+static void tv_sub(struct timeval *a, const struct timeval *b)
+{
+    a->tv_sec -= b->tv_sec;
+    a->tv_usec -= b->tv_usec;
+    if (a->tv_usec < 0)
+    {
+        a->tv_sec--;
+        a->tv_usec += 1000000;
+    }
+}
+
+/* the shell's usage plus that of every child it has reaped, for timing
+ * the builtins that run inside the shell */
+void timing_usage(struct rusage *ru)
+{
+    struct rusage children;
+
+    getrusage(RUSAGE_SELF, ru);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    tv_add(&ru->ru_utime, &children.ru_utime);
+    tv_add(&ru->ru_stime, &children.ru_stime);
+    if (children.ru_maxrss > ru->ru_maxrss)
+        ru->ru_maxrss = children.ru_maxrss;
+    ru->ru_nvcsw += children.ru_nvcsw;
+    ru->ru_nivcsw += children.ru_nivcsw;
+    ru->ru_minflt += children.ru_minflt;
+    ru->ru_majflt += children.ru_majflt;
+}
+
+/* turns ru into what was used since before; the peak RSS is kept as is */
+void timing_since(struct rusage *ru, const struct rusage *before)
+{
+    tv_sub(&ru->ru_utime, &before->ru_utime);
+    tv_sub(&ru->ru_stime, &before->ru_stime);
+    ru->ru_nvcsw -= before->ru_nvcsw;
+    ru->ru_nivcsw -= before->ru_nivcsw;
+    ru->ru_minflt -= before->ru_minflt;
+    ru->ru_majflt -= before->ru_majflt;
+}
+
+static void json_string(const char *s, FILE *fp)
+{
+    fputc('"', fp);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void print_usage(double real, const struct rusage *ru, int json, FILE *fp)
+{
+    if (json)
+        fprintf(fp, "\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                    "\"nvcsw\":%ld,\"nivcsw\":%ld,\"minflt\":%ld,\"majflt\":%ld",
+                real, tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime), ru->ru_maxrss,
+                ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+    else
+        fprintf(fp, "%9.3fs %8.3fs %8.3fs %8ldK %6ld %6ld %8ld %6ld",
+                real, tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime), ru->ru_maxrss,
+                ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+}
+
+/* one line per stage and a total, as a table or as JSON; status is the
+ * exit status of the pipeline */
+void timing_report(PipelineTime *pt, int status, FILE *fp)
+{
+    struct timespec *first = NULL, *last = NULL;
+    struct rusage total;
+    StageTime *s;
+    unsigned int i;
+
+    memset(&total, 0, sizeof(total));
+
+    if (pt->json)
+        fprintf(fp, "{\"stages\":[");
+    else
+        fprintf(fp, "stage %10s%10s%10s%10s%7s%7s%9s%7s  command\n",
+                "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "minflt", "majflt");
+
+    for (i = 0; i < pt->nstages; i++)
+    {
+        s = &pt->stages[i];
+
+        if (pt->json)
+        {
+            fprintf(fp, "%s{\"cmd\":", i ? "," : "");
+            json_string(s->cmd, fp);
+            if (s->reaped)
+            {
+                fputc(',', fp);
+                print_usage(ts_diff(&s->end, &s->start), &s->ru, 1, fp);
+            }
+            fputc('}', fp);
+        }
+        else
+        {
+            fprintf(fp, "%5u ", i);
+            if (s->reaped)
+                print_usage(ts_diff(&s->end, &s->start), &s->ru, 0, fp);
+            else
+                fprintf(fp, "%10s%10s%10s%10s%7s%7s%9s%7s", "-", "-", "-", "-", "-", "-", "-", "-");
+            fprintf(fp, "  %s\n", s->cmd);
+        }
+
+        if (!s->reaped)
+            continue;
+
+        if (!first || ts_diff(&s->start, first) < 0)
+            first = &s->start;
+        if (!last || ts_diff(&s->end, last) > 0)
+            last = &s->end;
+
+        tv_add(&total.ru_utime, &s->ru.ru_utime);
+        tv_add(&total.ru_stime, &s->ru.ru_stime);
+        if (s->ru.ru_maxrss > total.ru_maxrss)
+            total.ru_maxrss = s->ru.ru_maxrss;
+        total.ru_nvcsw += s->ru.ru_nvcsw;
+        total.ru_nivcsw += s->ru.ru_nivcsw;
+        total.ru_minflt += s->ru.ru_minflt;
+        total.ru_majflt += s->ru.ru_majflt;
+    }
+
+    if (pt->json)
+    {
+        fprintf(fp, "],\"total\":{");
+        print_usage(first ? ts_diff(last, first) : 0, &total, 1, fp);
+        fprintf(fp, ",\"status\":%d}}\n", status);
+    }
+    else
+    {
+        fprintf(fp, "total ");
+        print_usage(first ? ts_diff(last, first) : 0, &total, 0, fp);
+        fprintf(fp, "  status %d\n", status);
+    }
+}
+
+void timing_free(PipelineTime *pt)
+{
+    unsigned int i;
+
+    if (!pt)
+        return;
+
+    for (i = 0; i < pt->nstages; i++)
+        free(pt->stages[i].cmd);
+    free(pt->stages);
+    free(pt);
+}
@@ -0,0 +1,34 @@
+#ifndef _timing_h_
+#define _timing_h_
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "parse.h"
+
+typedef struct
+{
+    char *cmd;              /* the stage's command line */
+    struct timespec start;  /* just before it was started */
+    struct timespec end;    /* when it was reaped */
+    struct rusage ru;       /* zero if the exit was not collected by wait4() */
+    int reaped;
+} StageTime;
+
+/* what 'time pipeline' collects for every stage of a job */
+typedef struct
+{
+    StageTime *stages;
+    unsigned int nstages;
+    int json;               /* report as one line of JSON */
+} PipelineTime;
+
+PipelineTime *timing_new(Parse *P, int json);
+void timing_start(PipelineTime *pt, unsigned int i);
+void timing_stop(PipelineTime *pt, unsigned int i, const struct rusage *ru);
+void timing_usage(struct rusage *ru);
+void timing_since(struct rusage *ru, const struct rusage *before);
+void timing_report(PipelineTime *pt, int status, FILE *fp);
+void timing_free(PipelineTime *pt);
+
+#endif /* _timing_h_ */
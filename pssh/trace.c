@@ -0,0 +1,234 @@
+/* Event trace of the shell's hot path ('trace on', PSSH_TRACE=file).
+ *
+ * The shell records a timestamped event when readline hands it a line,
+ * for parsing and checking the line, for each fork or exec of a stage,
+ * for each reap and for each handoff of the terminal.  The file is in
+ * the Chrome trace format (a JSON array of events), so it can be opened
+ * in chrome://tracing or Perfetto to see where the time between Enter
+ * and the next prompt goes.
+ *
+ * Recording an event only copies it into a ring of fixed slots: a slot
+ * is claimed by moving the head on with a compare and swap and marked
+ * ready once it is filled in, so any thread can record without a lock
+ * and nothing is formatted or written on the hot path.  The shell
+ * writes the ready events out when it is about to wait for something
+ * anyway.  If the ring fills up in between, events are counted and
+ * dropped rather than waited for.
+ *
+ * A forked child keeps a copy of the ring but never writes it out. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_SLOTS 4096        /* a power of two */
+
+typedef struct
+{
+    unsigned long ready;        /* 1 + the position it holds, once written */
+    const char *name;
+    char phase;                 /* 'X' for a span, 'i' for an instant */
+    unsigned long long ts, dur; /* nanoseconds */
+    const char *key;            /* name of value, or NULL */
+    long value;
+    char detail[40];
+} Event;
+
+static Event *ring;
+static unsigned long head;      /* next position to hand out */
+static unsigned long tail;      /* next position to write out */
+static unsigned long dropped;
+
+static FILE *out;
+static char *out_path;
+static pid_t owner;
+static int written;             /* events in the file so far */
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record(char phase, const char *name, unsigned long long ts, unsigned long long dur,
+                   const char *detail, const char *key, long value)
+{
+    unsigned long pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    Event *e;
+
+    do
+    {
+        if (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= TRACE_SLOTS)
+        {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    e = &ring[pos & (TRACE_SLOTS - 1)];
+    e->name = name;
+    e->phase = phase;
+    e->ts = ts;
+    e->dur = dur;
+    e->key = key;
+    e->value = value;
+    if (detail)
+        snprintf(e->detail, sizeof(e->detail), "%s", detail);
+    else
+        e->detail[0] = '\0';
+
+    __atomic_store_n(&e->ready, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* the start time of a span, or 0 if tracing is off */
+unsigned long long trace_begin(void)
+{
+    return ring ? now_ns() : 0;
+}
+
+/* records the span from start (trace_begin()) to now.  detail, if not
+ * NULL, is kept up to its first 39 bytes; key names value, if not NULL. */
+void trace_end(unsigned long long start, const char *name, const char *detail,
+               const char *key, long value)
+{
+    if (!start || !ring)
+        return;
+
+    record('X', name, start, now_ns() - start, detail, key, value);
+}
+
+/* records a single point in time */
+void trace_mark(const char *name, const char *detail, const char *key, long value)
+{
+    if (!ring)
+        return;
+
+    record('i', name, now_ns(), 0, detail, key, value);
+}
+
+static void put_string(const char *s)
+{
+    putc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            putc(*s, out);
+    }
+    putc('"', out);
+}
+
+static void put_event(const Event *e)
+{
+    fprintf(out, "%s\n{\"name\":", written++ ? "," : "");
+    put_string(e->name);
+    fprintf(out, ",\"cat\":\"pssh\",\"ph\":\"%c\",\"ts\":%.3f", e->phase, e->ts / 1e3);
+    if (e->phase == 'X')
+        fprintf(out, ",\"dur\":%.3f", e->dur / 1e3);
+    else
+        fputs(",\"s\":\"p\"", out);
+    fprintf(out, ",\"pid\":%d,\"tid\":%d,\"args\":{", owner, owner);
+
+    if (e->detail[0])
+    {
+        fputs("\"detail\":", out);
+        put_string(e->detail);
+    }
+    if (e->key)
+        fprintf(out, "%s\"%s\":%ld", e->detail[0] ? "," : "", e->key, e->value);
+    fputs("}}", out);
+}
+
+static void drain(void)
+{
+    Event *e;
+
+    for (;;)
+    {
+        e = &ring[tail & (TRACE_SLOTS - 1)];
+        if (__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        put_event(e);
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* writes the recorded events out to the trace file */
+void trace_flush(void)
+{
+    unsigned long n;
+
+    if (!ring || tail == __atomic_load_n(&head, __ATOMIC_ACQUIRE) || getpid() != owner)
+        return;
+
+    n = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    drain();
+    if (n)
+    {
+        record('i', "trace dropped", now_ns(), 0, NULL, "events", n);
+        drain();
+    }
+
+    fflush(out);
+}
+
+/* starts tracing to path (truncated).  Returns -1 with errno set if it
+ * cannot be opened; tracing to another file is stopped first. */
+int trace_start(const char *path)
+{
+    static int registered;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "w")))
+        return -1;
+
+    trace_stop();
+    if (!registered++)
+        atexit(trace_stop);
+
+    out = fp;
+    out_path = strdup(path);
+    owner = getpid();
+    written = 0;
+    head = tail = dropped = 0;
+    ring = calloc(TRACE_SLOTS, sizeof(*ring));
+
+    fputs("[", out);
+    fprintf(out, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"pssh\"}}",
+            owner, owner);
+    written++;
+    fflush(out);
+
+    return 0;
+}
+
+/* writes out what is left and closes the trace file */
+void trace_stop(void)
+{
+    if (!ring || getpid() != owner)
+        return;
+
+    trace_flush();
+    fputs("\n]\n", out);
+    fclose(out);
+
+    free(ring);
+    free(out_path);
+    ring = NULL;
+    out = NULL;
+    out_path = NULL;
+}
+
+/* the file being traced to, or NULL if tracing is off */
+const char *trace_path(void)
+{
+    return ring ? out_path : NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef _trace_h_
+#define _trace_h_
+
+int trace_start(const char *path);
+void trace_stop(void);
+const char *trace_path(void);
+unsigned long long trace_begin(void);
+void trace_end(unsigned long long start, const char *name, const char *detail,
+               const char *key, long value);
+void trace_mark(const char *name, const char *detail, const char *key, long value);
+void trace_flush(void);
+
+#endif /* _trace_h_ */
@@ -0,0 +1,468 @@
+/* The zygote launch backend.
+ *
+ * fork() copies the page tables of everything the shell has mapped, and
+ * over a long session readline and the history keep growing.  The zygote
+ * is a second copy of pssh, exec'd afresh (as ZYGOTE_ARGV0) so it holds
+ * none of that, whose only job is to start children for the shell.
+ *
+ * The shell writes it one request per launch over a unix socket: path,
+ * argv, process group, CPU affinity and scheduling policy, the
+ * environment entries that differ from the ones the zygote was started
+ * with and the cwd if it differs, with the child's stdin, stdout and
+ * stderr attached as SCM_RIGHTS.  The zygote clones the child with
+ * CLONE_PARENT, so it is the shell's child: the shell reaps it, watches
+ * its pidfd and moves it between process groups exactly as if it had
+ * forked it.  The reply is the child's pid.
+ *
+ * The zygote never forks from the shell's heap after startup, so the
+ * cost of a launch stays flat however big the shell gets. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <linux/sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "cwd.h"
+#include "env.h"
+
+typedef struct
+{
+    size_t len;         /* bytes of strings that follow */
+    pid_t pgid;
+    int foreground;     /* take the terminal for the new group */
+    unsigned int argc;
+    unsigned int nenv;  /* "NAME=value" to set, "NAME" to unset */
+    int has_cwd;
+    int has_cpus;
+    CpuMask cpus;
+    int batch;
+} Request;
+
+/* the shell's side */
+static int zygote_fd = -1;
+static pid_t zygote_pid;
+static char **zygote_env;       /* the environment it was started with */
+static char zygote_cwd[PATH_MAX];
+
+/* signals the zygote ignores so the terminal cannot take it down with
+ * the shell's foreground; its children get the defaults back */
+static const int zygote_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE, 0};
+
+static void zygote_stop(void)
+{
+    char **e;
+
+    close(zygote_fd);
+    zygote_fd = -1;
+    waitpid(zygote_pid, NULL, 0);
+
+    for (e = zygote_env; e && *e; e++)
+        free(*e);
+    free(zygote_env);
+    zygote_env = NULL;
+}
+
+/* starts the zygote if it is not running; returns -1 if it cannot be */
+int zygote_start(void)
+{
+    char fd[16], **envp;
+    int sv[2], n;
+    pid_t ready;
+
+    if (zygote_fd != -1)
+        return 0;
+
+    /* before the environment: the first cwd_get() sets $PWD */
+    strcpy(zygote_cwd, cwd_get());
+    envp = env_vector();
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+
+    if ((zygote_pid = fork()) == -1)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (!zygote_pid)
+    {
+        /* its end of the socket is the only fd meant to survive exec */
+        fcntl(sv[1], F_SETFD, 0);
+        snprintf(fd, sizeof(fd), "%d", sv[1]);
+        execle("/proc/self/exe", ZYGOTE_ARGV0, fd, (char *)NULL, envp);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    zygote_fd = sv[0];
+
+    for (n = 0; envp[n]; n++)
+        ;
+    zygote_env = malloc((n + 1) * sizeof(*zygote_env));
+    for (n = 0; envp[n]; n++)
+        zygote_env[n] = strdup(envp[n]);
+    zygote_env[n] = NULL;
+
+    /* it says hello once it is up, or the socket closes if exec failed */
+    if (read(zygote_fd, &ready, sizeof(ready)) != sizeof(ready))
+    {
+        zygote_stop();
+        return -1;
+    }
+
+    return 0;
+}
+
+static int same_name(const char *a, const char *b)
+{
+    while (*a && *a != '=' && *a == *b)
+        a++, b++;
+
+    return (*a == '=' || !*a) && (*b == '=' || !*b);
+}
+
+/* entries of envp that differ from the zygote's environment, NULL
+ * terminated */
+static char **env_delta(char **envp, unsigned int *n)
+{
+    char **delta, **e, **z;
+    unsigned int i;
+
+    *n = 0;
+
+    /* almost always nothing has changed */
+    for (e = envp, z = zygote_env; *e && *z && !strcmp(*e, *z); e++, z++)
+        ;
+    if (!*e && !*z)
+        return NULL;
+
+    for (i = 0; envp[i]; i++)
+        ;
+    for (z = zygote_env; *z; z++)
+        i++;
+    delta = malloc((i + 1) * sizeof(*delta));
+
+    for (e = envp; *e; e++)
+    {
+        for (z = zygote_env; *z && strcmp(*e, *z); z++)
+            ;
+        if (!*z)
+            delta[(*n)++] = *e;
+    }
+
+    for (z = zygote_env; *z; z++)
+    {
+        for (e = envp; *e && !same_name(*e, *z); e++)
+            ;
+        if (!*e)
+            delta[(*n)++] = *z;     /* sent as its name alone: unset */
+    }
+
+    delta[*n] = NULL;
+    return delta;
+}
+
+static char *put_string(char *d, const char *s, size_t n)
+{
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d + n + 1;
+}
+
+static int send_all(int fd, struct msghdr *msg, size_t len)
+{
+    ssize_t n;
+
+    while (len)
+    {
+        if ((n = sendmsg(fd, msg, MSG_NOSIGNAL)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        len -= n;
+
+        /* the fds went with the first byte */
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
+        while (n && n >= msg->msg_iov->iov_len)
+        {
+            n -= msg->msg_iov->iov_len;
+            msg->msg_iov++;
+            msg->msg_iovlen--;
+        }
+        if (msg->msg_iovlen)
+        {
+            msg->msg_iov->iov_base = (char *)msg->msg_iov->iov_base + n;
+            msg->msg_iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+/* has the zygote start path with argv and environment envp, in process
+ * group pgid, maybe in the foreground and with attrs (as for
+ * launch_exec()) and with in/out/err as its stdin/stdout/stderr.
+ * Returns the child's pid, or -1 with errno set; EPIPE means the zygote
+ * is gone. */
+pid_t zygote_launch(const char *path, char **argv, char **envp,
+                    int in, int out, int err, pid_t pgid, int foreground,
+                    const LaunchAttrs *attrs)
+{
+    const char *cwd = cwd_get();
+    char *body, *d, **delta;
+    union
+    {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[2];
+    Request req;
+    unsigned int i;
+    pid_t pid;
+    int fds[3] = {in, out, err};
+
+    if (zygote_start() == -1)
+        return -1;
+
+    memset(&req, 0, sizeof(req));
+    req.pgid = pgid;
+    req.foreground = foreground;
+    req.has_cwd = cwd[0] && strcmp(cwd, zygote_cwd);
+    if (attrs && attrs->cpus)
+    {
+        req.has_cpus = 1;
+        req.cpus = *attrs->cpus;
+    }
+    req.batch = attrs && attrs->batch;
+    delta = env_delta(envp, &req.nenv);
+
+    req.len = strlen(path) + 1;
+    for (req.argc = 0; argv[req.argc]; req.argc++)
+        req.len += strlen(argv[req.argc]) + 1;
+    for (i = 0; i < req.nenv; i++)
+        req.len += strlen(delta[i]) + 1;
+    if (req.has_cwd)
+        req.len += strlen(cwd) + 1;
+
+    d = body = malloc(req.len);
+    d = put_string(d, path, strlen(path));
+    for (i = 0; i < req.argc; i++)
+        d = put_string(d, argv[i], strlen(argv[i]));
+    for (i = 0; i < req.nenv; i++)
+        d = put_string(d, delta[i], strlen(delta[i]));
+    if (req.has_cwd)
+        d = put_string(d, cwd, strlen(cwd));
+    free(delta);
+
+    iov[0].iov_base = &req;
+    iov[0].iov_len = sizeof(req);
+    iov[1].iov_base = body;
+    iov[1].iov_len = req.len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (send_all(zygote_fd, &msg, sizeof(req) + req.len) == -1 ||
+        read(zygote_fd, &pid, sizeof(pid)) != sizeof(pid))
+    {
+        free(body);
+        zygote_stop();
+        errno = EPIPE;
+        return -1;
+    }
+
+    free(body);
+    if (pid < 0)
+    {
+        errno = -pid;
+        return -1;
+    }
+    return pid;
+}
+
+/* the zygote's side */
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len)
+    {
+        if ((n = read(fd, buf, len)) <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* receives a request and the three fds attached to it */
+static char *receive(int sock, Request *req, int *fds)
+{
+    char ctl[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char *body;
+    ssize_t n;
+
+    fds[0] = fds[1] = fds[2] = -1;
+    iov.iov_base = req;
+    iov.iov_len = sizeof(*req);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return NULL;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    if (n < sizeof(*req) && read_all(sock, (char *)req + n, sizeof(*req) - n) == -1)
+        return NULL;
+
+    body = malloc(req->len);
+    if (read_all(sock, body, req->len) == -1)
+    {
+        free(body);
+        return NULL;
+    }
+
+    return body;
+}
+
+/* runs in the new child: everything the shell would have set up itself */
+static void child(Request *req, char *body, int *fds)
+{
+    LaunchAttrs attrs = {NULL};
+    char *path, **argv, *s;
+    sigset_t none;
+    unsigned int i;
+
+    path = body;
+    s = path + strlen(path) + 1;
+
+    argv = malloc((req->argc + 1) * sizeof(*argv));
+    for (i = 0; i < req->argc; i++, s += strlen(s) + 1)
+        argv[i] = s;
+    argv[i] = NULL;
+
+    for (i = 0; i < req->nenv; i++, s += strlen(s) + 1)
+    {
+        if (strchr(s, '='))
+            putenv(s);
+        else
+            unsetenv(s);
+    }
+
+    if (req->has_cwd && chdir(s) == -1)
+    {
+        fprintf(stderr, "pssh: %s: %s\n", s, strerror(errno));
+        _exit(127);
+    }
+
+    if (req->pgid >= 0)
+        setpgid(0, req->pgid);
+    /* the zygote shares the shell's terminal on 0 and ignores SIGTTOU */
+    if (req->foreground)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+
+    for (i = 0; zygote_signals[i]; i++)
+        signal(zygote_signals[i], SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    if (req->has_cpus)
+        attrs.cpus = &req->cpus;
+    attrs.batch = req->batch;
+    launch_apply(&attrs);
+
+    /* the received fds are close-on-exec; their copies on 0-2 are not */
+    for (i = 0; i < 3; i++)
+        if (fds[i] != -1)
+            dup2(fds[i], i);
+
+    execv(path, argv);
+    fprintf(stderr, "pssh: %s: %s\n", path, strerror(errno));
+    _exit(127);
+}
+
+/* serves launch requests on the socket in argv[1] until the shell goes
+ * away */
+int zygote_main(int argc, char **argv)
+{
+    Request req;
+    char *body;
+    sigset_t none;
+    pid_t pid;
+    int sock, fds[3], i;
+
+    if (argc != 2)
+        return 2;
+
+    sock = atoi(argv[1]);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+    for (i = 0; zygote_signals[i]; i++)
+        signal(zygote_signals[i], SIG_IGN);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    pid = getpid();
+    if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+        return 1;
+
+    while ((body = receive(sock, &req, fds)))
+    {
+        /* like fork(), but the child is the shell's */
+        pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+        if (!pid)
+            child(&req, body, fds);
+        if (pid == -1)
+            pid = -errno;
+
+        for (i = 0; i < 3; i++)
+            if (fds[i] != -1)
+                close(fds[i]);
+        free(body);
+
+        if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+            break;
+    }
+
+    return 0;
+}
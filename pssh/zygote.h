@@ -0,0 +1,16 @@
+#ifndef _zygote_h_
+#define _zygote_h_
+
+#include <sys/types.h>
+#include "launch.h"
+
+/* argv[0] the zygote is exec'd with; main() hands over to zygote_main() */
+#define ZYGOTE_ARGV0 "pssh-zygote"
+
+int zygote_start(void);
+pid_t zygote_launch(const char *path, char **argv, char **envp,
+                    int in, int out, int err, pid_t pgid, int foreground,
+                    const LaunchAttrs *attrs);
+int zygote_main(int argc, char **argv);
+
+#endif /* _zygote_h_ */